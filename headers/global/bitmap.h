@@ -0,0 +1,86 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#define BITMAP_WORD_BITS 64 // bits of a word, scanned at once
+#define BITMAP_WORDS(bits) (((bits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS) // words holding bits
+
+/**
+ * @fn      int bitmapTest(const uint64_t *bitmap, uint32_t bit)
+ * @brief   Reads a bit
+ * @param   bitmap  Words of the bitmap
+ * @param   bit     Index of the bit
+ * @return  1 if it is set, else 0
+ */
+int bitmapTest(const uint64_t *bitmap, uint32_t bit);
+
+/**
+ * @fn      uint32_t bitmapFill(uint64_t *bitmap, uint32_t from, uint32_t to, int value)
+ * @brief   Sets or clears the bits from..to (excluded), a word at a time
+ * @param   bitmap  Words of the bitmap
+ * @param   from    First bit
+ * @param   to      Bit following the last one
+ * @param   value   1 to set them, 0 to clear them
+ * @return  The number of bits which changed
+ */
+uint32_t bitmapFill(uint64_t *bitmap, uint32_t from, uint32_t to, int value);
+
+/**
+ * @fn      uint32_t bitmapFind(const uint64_t *bitmap, uint32_t from, uint32_t to, int value)
+ * @brief   Finds the first bit equal to value from..to (excluded), a word at a time
+ * @param   bitmap  Words of the bitmap
+ * @param   from    First bit
+ * @param   to      Bit following the last one
+ * @param   value   1 to find a bit set, 0 to find a bit cleared
+ * @return  Index of the bit, to if there is none
+ */
+uint32_t bitmapFind(const uint64_t *bitmap, uint32_t from, uint32_t to, int value);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+int bitmapTest(const uint64_t *bitmap, uint32_t bit)
+{
+    return (bitmap[bit / BITMAP_WORD_BITS] >> (bit % BITMAP_WORD_BITS)) & 1;
+}
+
+uint32_t bitmapFill(uint64_t *bitmap, uint32_t from, uint32_t to, int value)
+{
+    uint32_t changed = 0;
+    while (from < to)
+    {
+        uint32_t shift = from % BITMAP_WORD_BITS;
+        uint32_t nb = MIN(BITMAP_WORD_BITS - shift, to - from);
+        uint64_t mask = (nb == BITMAP_WORD_BITS ? ~(uint64_t) 0 : ((uint64_t) 1 << nb) - 1) << shift;
+
+        uint64_t *word = &bitmap[from / BITMAP_WORD_BITS];
+        uint64_t old = *word;
+        *word = value ? old | mask : old & ~mask;
+        changed += (uint32_t) __builtin_popcountll(old ^ *word);
+        from += nb;
+    }
+    return changed;
+}
+
+uint32_t bitmapFind(const uint64_t *bitmap, uint32_t from, uint32_t to, int value)
+{
+    if (from >= to)
+        return to;
+
+    // looking for a bit cleared is looking for a bit set in the words inverted
+    uint64_t invert = value ? 0 : ~(uint64_t) 0;
+    uint32_t index = from / BITMAP_WORD_BITS;
+    uint64_t word = (bitmap[index] ^ invert) & (~(uint64_t) 0 << (from % BITMAP_WORD_BITS));
+
+    while (word == 0) // nothing in this word, the next one
+    {
+        if (++index * BITMAP_WORD_BITS >= to)
+            return to;
+        word = bitmap[index] ^ invert;
+    }
+
+    uint32_t found = index * BITMAP_WORD_BITS + (uint32_t) __builtin_ctzll(word);
+    return MIN(found, to);
+}
+
+#endif //_BITMAP_H
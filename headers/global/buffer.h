@@ -0,0 +1,143 @@
+#ifndef _BUFFER_H
+#define _BUFFER_H
+
+#define BUFFER_CHUNK_MIN 4096 // size of the first chunk of a buffer
+#define BUFFER_CHUNK_MAX (1 << 20) // chunks double until this size, then stay there
+
+/** @struct chunk
+ *  @brief This structure is a piece of a buffer, never moved once allocated
+ */
+/** @var chunk::next
+ *  Member 'next' is the following chunk, NULL for the last one
+ */
+/** @var chunk::size
+ *  Member 'size' contains the number of bytes the chunk can hold
+ */
+/** @var chunk::used
+ *  Member 'used' contains the number of bytes it holds
+ */
+/** @var chunk::data
+ *  Member 'data' contains the bytes
+ */
+struct chunk
+{
+    struct chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+/** @struct buffer
+ *  @brief List of chunks growing at its end : an append never copies what the buffer already holds
+ */
+/** @var buffer::first
+ *  Member 'first' is the oldest chunk, NULL while the buffer is empty
+ */
+/** @var buffer::last
+ *  Member 'last' is the chunk appends go to
+ */
+/** @var buffer::size
+ *  Member 'size' contains the number of bytes in the buffer
+ */
+struct buffer
+{
+    struct chunk *first;
+    struct chunk *last;
+    size_t size;
+};
+
+/**
+ * @fn      void initBuffer(struct buffer *buffer)
+ * @brief   Prepares an empty buffer, no chunk until the first append
+ * @param   buffer  Buffer to prepare
+ */
+void initBuffer(struct buffer *buffer);
+
+/**
+ * @fn      void destroyBuffer(struct buffer *buffer)
+ * @brief   Frees every chunk of a buffer, it is empty again
+ * @param   buffer  Buffer to destroy
+ */
+void destroyBuffer(struct buffer *buffer);
+
+/**
+ * @fn      void bufferAppend(struct buffer *buffer, const char *data, size_t len)
+ * @brief   Copies data at the end of a buffer (binary safe), amortized O(1) for each byte
+ * @param   buffer  Buffer to fill
+ * @param   data    Data to add
+ * @param   len     Size of the data
+ */
+void bufferAppend(struct buffer *buffer, const char *data, size_t len);
+
+/**
+ * @fn      int bufferWrite(struct buffer *buffer, FILE *stream)
+ * @brief   Writes the content of a buffer, chunk after chunk
+ * @param   buffer  Buffer to write
+ * @param   stream  Where to write it
+ * @return  -1 if an error has occurred, else 0
+ */
+int bufferWrite(struct buffer *buffer, FILE *stream);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+void initBuffer(struct buffer *buffer)
+{
+    buffer->first = NULL;
+    buffer->last = NULL;
+    buffer->size = 0;
+}
+
+void destroyBuffer(struct buffer *buffer)
+{
+    struct chunk *chunk = buffer->first;
+    while (chunk != NULL)
+    {
+        struct chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    initBuffer(buffer);
+}
+
+void bufferAppend(struct buffer *buffer, const char *data, size_t len)
+{
+    buffer->size += len;
+    while (len > 0)
+    {
+        struct chunk *last = buffer->last;
+        if (last == NULL || last->used == last->size) // full : a new chunk, twice as big as the last one
+        {
+            size_t size = last == NULL ? BUFFER_CHUNK_MIN : MIN(last->size * 2, BUFFER_CHUNK_MAX);
+            struct chunk *chunk = malloc(sizeof(struct chunk) + size);
+            if (chunk == NULL)
+                raler("bufferAppend");
+            chunk->next = NULL;
+            chunk->size = size;
+            chunk->used = 0;
+
+            if (last == NULL)
+                buffer->first = chunk;
+            else
+                last->next = chunk;
+            buffer->last = last = chunk;
+        }
+
+        size_t nb = MIN(len, last->size - last->used);
+        memcpy(last->data + last->used, data, nb);
+        last->used += nb;
+        data += nb;
+        len -= nb;
+    }
+}
+
+int bufferWrite(struct buffer *buffer, FILE *stream)
+{
+    for (struct chunk *chunk = buffer->first; chunk != NULL; chunk = chunk->next)
+        if (fwrite(chunk->data, 1, chunk->used, stream) != chunk->used)
+            return -1;
+    return 0;
+}
+
+#endif //_BUFFER_H
@@ -0,0 +1,500 @@
+#ifndef _CONGESTION_H
+#define _CONGESTION_H
+
+#define CONGESTION_INITIAL_WINDOW 1 // window of a new connection, in packets
+#define CONGESTION_MIN_WINDOW 2 // lowest window after a loss, in packets
+
+#define CUBIC_C 0.4 // aggressiveness of the cubic function (RFC 9438)
+#define CUBIC_BETA 0.7 // window kept after a loss
+
+#define BBR_HIGH_GAIN 2.885 // 2/ln(2) : startup doubles the delivery rate every RTT
+#define BBR_CWND_GAIN 2.0 // window kept over the BDP, for delayed and stretched ACKs
+#define BBR_BW_ROUNDS 10 // the bottleneck bandwidth is the max of the last BBR_BW_ROUNDS rounds
+#define BBR_MIN_RTT_WINDOW 10000000 // the min RTT is measured again after 10s, in microseconds
+#define BBR_PROBE_RTT_TIME 200000 // time spent with a minimal window to measure the min RTT, in microseconds
+#define BBR_PROBE_RTT_WINDOW 4 // window while measuring the min RTT, in packets
+#define BBR_CYCLE 8 // number of phases of the PROBE_BW gain cycle
+#define BBR_FULL_BW_ROUNDS 3 // startup is over after 3 rounds without 25% more bandwidth
+
+struct congestion;
+
+/** @struct congestion_ops
+ *  @brief This structure contains the functions of a congestion control algorithm, chosen by the user
+ *         Windows are counted in packets, inflight is the number of packets sent and not acknowledged yet
+ */
+/** @var congestion_ops::name
+ *  Member 'name' is the name the user gives on the command line
+ */
+/** @var congestion_ops::init
+ *  Member 'init' resets the state, the connection (re)starts
+ */
+/** @var congestion_ops::on_ack
+ *  Member 'on_ack' is called when an ACK acknowledges new packets
+ */
+/** @var congestion_ops::on_loss
+ *  Member 'on_loss' is called when the ACKs show a loss, at most once per window
+ */
+/** @var congestion_ops::on_ecn
+ *  Member 'on_ecn' is called when an ACK carries the ECN bit, at most once per window
+ */
+/** @var congestion_ops::on_timeout
+ *  Member 'on_timeout' is called when the retransmission timer expires
+ */
+/** @var congestion_ops::pacing_rate
+ *  Member 'pacing_rate' gives the rate the packets should leave at, in packets per second (0 : unknown)
+ */
+struct congestion_ops
+{
+    const char *name;
+    void (*init)(struct congestion *cc);
+    void (*on_ack)(struct congestion *cc, uint32_t acked, uint32_t inflight, const struct rtt *rtt, uint64_t now);
+    void (*on_loss)(struct congestion *cc, uint32_t inflight, uint64_t now);
+    void (*on_ecn)(struct congestion *cc, uint32_t inflight, uint64_t now);
+    void (*on_timeout)(struct congestion *cc, uint32_t inflight, uint64_t now);
+    uint64_t (*pacing_rate)(struct congestion *cc, const struct rtt *rtt);
+};
+
+/** @enum bbr_mode
+ *  @brief This enum describes the current phase of the BBR-like controller
+ */
+enum bbr_mode
+{
+    BBR_STARTUP = 0,        /**< Exponential growth until the bandwidth stops growing */
+    BBR_DRAIN = 1,          /**< Empties the queue built during startup */
+    BBR_PROBE_BW = 2,       /**< Cycles the pacing gain around the bottleneck bandwidth */
+    BBR_PROBE_RTT = 3       /**< Minimal window, the queue empties and the min RTT can be measured */
+};
+
+/** @struct congestion
+ *  @brief This structure stores the congestion control state of a flux
+ */
+/** @var congestion::ops
+ *  Member 'ops' contains the functions of the algorithm
+ */
+/** @var congestion::cwnd
+ *  Member 'cwnd' contains the congestion window, in packets (fractional : grows by less than a packet per ACK)
+ */
+/** @var congestion::ssthresh
+ *  Member 'ssthresh' contains the slow start threshold, in packets
+ */
+/** @var congestion::w_max
+ *  Member 'w_max' contains the window before the last loss (CUBIC)
+ */
+/** @var congestion::w_est
+ *  Member 'w_est' contains the window Reno would have (CUBIC, TCP-friendly region)
+ */
+/** @var congestion::k
+ *  Member 'k' contains the time the cubic function takes to come back to w_max, in seconds (CUBIC)
+ */
+/** @var congestion::epoch
+ *  Member 'epoch' contains the start of the current congestion avoidance, 0 if not started (CUBIC)
+ */
+/** @var congestion::mode
+ *  Member 'mode' contains the current phase (BBR)
+ */
+/** @var congestion::bw
+ *  Member 'bw' contains the max delivery rate of each of the last rounds, in packets per second (BBR)
+ */
+/** @var congestion::round
+ *  Member 'round' counts the rounds, a round lasts one min RTT (BBR)
+ */
+/** @var congestion::round_start
+ *  Member 'round_start' contains the time the current round started (BBR)
+ */
+/** @var congestion::delivered
+ *  Member 'delivered' contains the number of packets acknowledged during the current round (BBR)
+ */
+/** @var congestion::full_bw
+ *  Member 'full_bw' contains the bandwidth startup has to beat by 25% (BBR)
+ */
+/** @var congestion::full_bw_rounds
+ *  Member 'full_bw_rounds' counts the rounds startup did not beat full_bw (BBR)
+ */
+/** @var congestion::min_rtt
+ *  Member 'min_rtt' contains the lowest RTT measured, in microseconds, 0 if none (BBR)
+ */
+/** @var congestion::min_rtt_stamp
+ *  Member 'min_rtt_stamp' contains the time min_rtt has been measured (BBR)
+ */
+/** @var congestion::probe_rtt_end
+ *  Member 'probe_rtt_end' contains the time PROBE_RTT is over (BBR)
+ */
+/** @var congestion::cycle
+ *  Member 'cycle' contains the current phase of the PROBE_BW gain cycle (BBR)
+ */
+/** @var congestion::inflight_hi
+ *  Member 'inflight_hi' contains the highest window without loss nor ECN, 0 if none (BBR)
+ */
+struct congestion
+{
+    const struct congestion_ops *ops;
+    double cwnd;
+    double ssthresh;
+
+    double w_max;
+    double w_est;
+    double k;
+    uint64_t epoch;
+
+    enum bbr_mode mode;
+    double bw[BBR_BW_ROUNDS];
+    uint64_t round;
+    uint64_t round_start;
+    uint32_t delivered;
+    double full_bw;
+    int full_bw_rounds;
+    uint32_t min_rtt;
+    uint64_t min_rtt_stamp;
+    uint64_t probe_rtt_end;
+    int cycle;
+    double inflight_hi;
+};
+
+/**
+ * @fn      const struct congestion_ops *findCongestion(const char *name)
+ * @brief   Finds a congestion control algorithm by its name
+ * @param   name    Name given by the user (newreno, cubic, bbr)
+ * @return  The algorithm, NULL if it doesn't exist
+ */
+const struct congestion_ops *findCongestion(const char *name);
+
+/**
+ * @fn      void initCongestion(struct congestion *cc, const struct congestion_ops *ops)
+ * @brief   Prepares the congestion control of a flux
+ * @param   cc      Congestion control to prepare
+ * @param   ops     Algorithm used
+ */
+void initCongestion(struct congestion *cc, const struct congestion_ops *ops);
+
+/**
+ * @fn      uint32_t congestionWindow(struct congestion *cc)
+ * @brief   Number of packets that can be in flight
+ * @param   cc      Congestion control of the flux
+ * @return  The window, at least one packet
+ */
+uint32_t congestionWindow(struct congestion *cc);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+/**
+ * @fn      uint64_t windowRate(struct congestion *cc, const struct rtt *rtt, double gain)
+ * @brief   Rate sending a whole window each smoothed RTT (window based algorithms)
+ * @param   cc      Congestion control of the flux
+ * @param   rtt     RTT estimation of the flux
+ * @param   gain    Rate sent above the window
+ * @return  The rate in packets per second, 0 before the first RTT measure
+ */
+uint64_t windowRate(struct congestion *cc, const struct rtt *rtt, double gain)
+{
+    if (!rtt->measured || rtt->srtt == 0)
+        return 0;
+    return (uint64_t) (gain * cc->cwnd * 1000000.0 / rtt->srtt);
+}
+
+/* NewReno (RFC 5681, RFC 6582) : slow start up to ssthresh, then one packet more per window acknowledged */
+
+void renoInit(struct congestion *cc)
+{
+    cc->cwnd = CONGESTION_INITIAL_WINDOW;
+    cc->ssthresh = UINT32_MAX;
+}
+
+void renoOnAck(struct congestion *cc, uint32_t acked, uint32_t inflight, const struct rtt *rtt, uint64_t now)
+{
+    (void) inflight; (void) rtt; (void) now;
+
+    if (cc->cwnd < cc->ssthresh) // slow start : one packet more per packet acknowledged
+    {
+        cc->cwnd = MIN(cc->cwnd + acked, MAX(cc->ssthresh, cc->cwnd + 1));
+        return;
+    }
+    cc->cwnd += (double) acked / cc->cwnd; // congestion avoidance : one packet more per window
+}
+
+void renoOnLoss(struct congestion *cc, uint32_t inflight, uint64_t now)
+{
+    (void) now;
+    cc->ssthresh = MAX(inflight / 2.0, CONGESTION_MIN_WINDOW);
+    cc->cwnd = cc->ssthresh;
+}
+
+void renoOnTimeout(struct congestion *cc, uint32_t inflight, uint64_t now)
+{
+    (void) now;
+    cc->ssthresh = MAX(inflight / 2.0, CONGESTION_MIN_WINDOW);
+    cc->cwnd = 1; // slow start again
+}
+
+uint64_t renoPacingRate(struct congestion *cc, const struct rtt *rtt)
+{
+    return windowRate(cc, rtt, cc->cwnd < cc->ssthresh ? 2.0 : 1.2); // what Linux uses
+}
+
+/* CUBIC (RFC 9438) : the window follows a cubic function of the time since the last loss, centered on w_max */
+
+/**
+ * @fn      double cubeRoot(double x)
+ * @brief   Cube root without libm (Newton)
+ * @param   x       Positive number
+ * @return  Its cube root
+ */
+double cubeRoot(double x)
+{
+    if (x <= 0)
+        return 0;
+    double y = x < 1 ? 1 : x / 3;
+    for (int i = 0; i < 40; ++i)
+    {
+        double next = (2 * y + x / (y * y)) / 3;
+        if (next == y)
+            break;
+        y = next;
+    }
+    return y;
+}
+
+void cubicInit(struct congestion *cc)
+{
+    renoInit(cc);
+    cc->w_max = 0;
+    cc->w_est = 0;
+    cc->k = 0;
+    cc->epoch = 0;
+}
+
+void cubicOnAck(struct congestion *cc, uint32_t acked, uint32_t inflight, const struct rtt *rtt, uint64_t now)
+{
+    if (cc->cwnd < cc->ssthresh)
+    {
+        renoOnAck(cc, acked, inflight, rtt, now);
+        return;
+    }
+
+    if (cc->epoch == 0) // congestion avoidance starts
+    {
+        cc->epoch = now;
+        cc->w_est = cc->cwnd;
+        if (cc->cwnd < cc->w_max)
+            cc->k = cubeRoot((cc->w_max - cc->cwnd) / CUBIC_C);
+        else
+        {
+            cc->k = 0;
+            cc->w_max = cc->cwnd;
+        }
+    }
+
+    // W_cubic(t + RTT) : where the window should be one RTT from now
+    double t = (now - cc->epoch + rtt->srtt) / 1000000.0 - cc->k;
+    double target = cc->w_max + CUBIC_C * t * t * t;
+
+    // Reno-friendly region : never slower than Reno with the same beta
+    cc->w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * acked / cc->cwnd;
+    target = MAX(target, cc->w_est);
+
+    if (target > cc->cwnd) // at most 1.5x per RTT
+        cc->cwnd += MIN(target - cc->cwnd, cc->cwnd / 2) * acked / cc->cwnd;
+}
+
+void cubicOnLoss(struct congestion *cc, uint32_t inflight, uint64_t now)
+{
+    (void) inflight; (void) now;
+
+    // fast convergence : another flux took the bandwidth, let it have it
+    double w_max = cc->cwnd;
+    if (w_max < cc->w_max)
+        w_max = w_max * (1 + CUBIC_BETA) / 2;
+    cc->w_max = w_max;
+
+    cc->cwnd = MAX(cc->cwnd * CUBIC_BETA, CONGESTION_MIN_WINDOW);
+    cc->ssthresh = cc->cwnd;
+    cc->epoch = 0;
+}
+
+void cubicOnTimeout(struct congestion *cc, uint32_t inflight, uint64_t now)
+{
+    cubicOnLoss(cc, inflight, now);
+    cc->cwnd = 1; // slow start again, up to the reduced window
+}
+
+/* BBR-like : models the path (bottleneck bandwidth, min RTT) and keeps about one BDP in flight */
+
+const double bbrCycle[BBR_CYCLE] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+/**
+ * @fn      double bbrBandwidth(struct congestion *cc)
+ * @brief   Bottleneck bandwidth : max delivery rate of the last rounds
+ * @param   cc      Congestion control of the flux
+ * @return  The bandwidth in packets per second, 0 if not measured yet
+ */
+double bbrBandwidth(struct congestion *cc)
+{
+    double bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; ++i)
+        bw = MAX(bw, cc->bw[i]);
+    return bw;
+}
+
+/**
+ * @fn      double bbrPacingGain(struct congestion *cc)
+ * @brief   Rate sent above the bottleneck bandwidth, depends on the phase
+ * @param   cc      Congestion control of the flux
+ * @return  The gain
+ */
+double bbrPacingGain(struct congestion *cc)
+{
+    if (cc->mode == BBR_STARTUP)
+        return BBR_HIGH_GAIN;
+    if (cc->mode == BBR_DRAIN)
+        return 1 / BBR_HIGH_GAIN;
+    if (cc->mode == BBR_PROBE_BW)
+        return bbrCycle[cc->cycle];
+    return 1;
+}
+
+void bbrInit(struct congestion *cc)
+{
+    renoInit(cc);
+    cc->mode = BBR_STARTUP;
+    for (int i = 0; i < BBR_BW_ROUNDS; ++i)
+        cc->bw[i] = 0;
+    cc->round = 0;
+    cc->round_start = 0;
+    cc->delivered = 0;
+    cc->full_bw = 0;
+    cc->full_bw_rounds = 0;
+    cc->min_rtt = 0;
+    cc->min_rtt_stamp = 0;
+    cc->probe_rtt_end = 0;
+    cc->cycle = 0;
+    cc->inflight_hi = 0;
+}
+
+void bbrOnAck(struct congestion *cc, uint32_t acked, uint32_t inflight, const struct rtt *rtt, uint64_t now)
+{
+    // min RTT, measured again once too old
+    if (rtt->latest != 0 && (cc->min_rtt == 0 || rtt->latest <= cc->min_rtt || now - cc->min_rtt_stamp > BBR_MIN_RTT_WINDOW))
+    {
+        cc->min_rtt = rtt->latest;
+        cc->min_rtt_stamp = now;
+    }
+    if (cc->min_rtt == 0) // nothing can be modeled yet
+    {
+        renoOnAck(cc, acked, inflight, rtt, now);
+        return;
+    }
+    if (cc->round_start == 0)
+        cc->round_start = now;
+
+    // a round lasts one min RTT, its delivery rate is a sample of the bandwidth
+    cc->delivered += acked;
+    if (now - cc->round_start >= cc->min_rtt)
+    {
+        double rate = cc->delivered * 1000000.0 / (now - cc->round_start);
+        cc->round++;
+        cc->bw[cc->round % BBR_BW_ROUNDS] = rate;
+        cc->delivered = 0;
+        cc->round_start = now;
+
+        if (cc->mode == BBR_STARTUP) // the pipe is full once the bandwidth stops growing
+        {
+            if (rate >= cc->full_bw * 1.25)
+            {
+                cc->full_bw = rate;
+                cc->full_bw_rounds = 0;
+            }
+            else if (++cc->full_bw_rounds >= BBR_FULL_BW_ROUNDS)
+                cc->mode = BBR_DRAIN;
+        }
+        else if (cc->mode == BBR_PROBE_BW) // next phase of the gain cycle, probing up lifts the loss limit
+        {
+            if (bbrCycle[cc->cycle] > 1 && cc->inflight_hi > 0)
+                cc->inflight_hi++;
+            cc->cycle = (cc->cycle + 1) % BBR_CYCLE;
+        }
+    }
+
+    double bdp = bbrBandwidth(cc) * cc->min_rtt / 1000000.0;
+    if (cc->mode == BBR_DRAIN && inflight <= bdp)
+    {
+        cc->mode = BBR_PROBE_BW;
+        cc->cycle = 2; // cruising
+    }
+
+    // the min RTT is too old : the queue has to be emptied to measure it again
+    if (cc->mode != BBR_PROBE_RTT && now - cc->min_rtt_stamp > BBR_MIN_RTT_WINDOW)
+    {
+        cc->mode = BBR_PROBE_RTT;
+        cc->probe_rtt_end = now + BBR_PROBE_RTT_TIME;
+    }
+    if (cc->mode == BBR_PROBE_RTT && now >= cc->probe_rtt_end)
+    {
+        cc->min_rtt_stamp = now;
+        cc->mode = cc->full_bw_rounds >= BBR_FULL_BW_ROUNDS ? BBR_PROBE_BW : BBR_STARTUP;
+    }
+
+    if (cc->mode == BBR_PROBE_RTT)
+        cc->cwnd = BBR_PROBE_RTT_WINDOW;
+    else if (cc->mode == BBR_STARTUP && cc->cwnd < BBR_HIGH_GAIN * bdp)
+        cc->cwnd += acked; // grows like slow start until the model is known
+    else
+        cc->cwnd = MAX((cc->mode == BBR_STARTUP ? BBR_HIGH_GAIN : BBR_CWND_GAIN) * bdp, BBR_PROBE_RTT_WINDOW);
+
+    if (cc->inflight_hi > 0)
+        cc->cwnd = MIN(cc->cwnd, cc->inflight_hi);
+}
+
+void bbrOnLoss(struct congestion *cc, uint32_t inflight, uint64_t now)
+{
+    (void) now;
+
+    // the model doesn't change, but the window that lost packets is a limit (BBRv2 inflight_hi)
+    cc->inflight_hi = MAX(inflight * CUBIC_BETA, BBR_PROBE_RTT_WINDOW);
+    cc->cwnd = MIN(cc->cwnd, cc->inflight_hi);
+    if (cc->mode == BBR_STARTUP) // losses : the pipe is full
+    {
+        cc->full_bw_rounds = BBR_FULL_BW_ROUNDS;
+        cc->mode = BBR_DRAIN;
+    }
+}
+
+void bbrOnTimeout(struct congestion *cc, uint32_t inflight, uint64_t now)
+{
+    bbrOnLoss(cc, inflight, now);
+    cc->cwnd = 1; // the window comes back with the model on the next ACK
+}
+
+uint64_t bbrPacingRate(struct congestion *cc, const struct rtt *rtt)
+{
+    double bw = bbrBandwidth(cc);
+    if (bw == 0)
+        return windowRate(cc, rtt, BBR_HIGH_GAIN);
+    return (uint64_t) (bbrPacingGain(cc) * bw);
+}
+
+const struct congestion_ops newReno = { "newreno", renoInit, renoOnAck, renoOnLoss, renoOnLoss, renoOnTimeout, renoPacingRate };
+const struct congestion_ops cubic = { "cubic", cubicInit, cubicOnAck, cubicOnLoss, cubicOnLoss, cubicOnTimeout, renoPacingRate };
+const struct congestion_ops bbr = { "bbr", bbrInit, bbrOnAck, bbrOnLoss, bbrOnLoss, bbrOnTimeout, bbrPacingRate };
+
+const struct congestion_ops *findCongestion(const char *name)
+{
+    const struct congestion_ops *all[] = { &newReno, &cubic, &bbr };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); ++i)
+        if (strcmp(all[i]->name, name) == 0)
+            return all[i];
+    return NULL;
+}
+
+void initCongestion(struct congestion *cc, const struct congestion_ops *ops)
+{
+    cc->ops = ops;
+    ops->init(cc);
+}
+
+uint32_t congestionWindow(struct congestion *cc)
+{
+    return cc->cwnd < 1 ? 1 : (uint32_t) MIN(cc->cwnd, UINT32_MAX);
+}
+
+#endif //_CONGESTION_H
@@ -0,0 +1,488 @@
+#ifndef _INFLIGHT_H
+#define _INFLIGHT_H
+
+#define INFLIGHT_MIN_SIZE 64 // segments tracked by a new tracker, power of 2 and a whole word of the bitmaps
+#define INFLIGHT_MAX_SIZE (1 << 16) // most segments in flight, power of 2 : the biggest window
+
+/** @struct segment
+ *  @brief This structure stores what the source knows about a segment sent and not acknowledged yet
+ */
+/** @var segment::sent
+ *  Member 'sent' contains the time the segment has last been sent (timestampNow)
+ */
+/** @var segment::retransmits
+ *  Member 'retransmits' contains the number of times the segment has been sent again
+ */
+/** @var segment::prev
+ *  Member 'prev' contains the sequence number of the segment queued just before it, while it is queued
+ */
+/** @var segment::next
+ *  Member 'next' contains the sequence number of the segment queued just after it, while it is queued
+ */
+/** @var segment::queued
+ *  Member 'queued' is set while the segment is in the network : neither acknowledged nor lost since it has been sent
+ */
+struct segment
+{
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t prev;
+    uint32_t next;
+    int queued;
+};
+
+/** @struct inflight
+ *  @brief Ring of the segments in flight, indexed by their sequence number : from snd_una to snd_max
+ *         Its scoreboard tells which ones arrived (ACK, SACK) and which ones are lost, a bit for each
+ *         The segments still in the network are queued in the order they have been sent, a segment sent again
+ *         moves to the end of the queue (RACK, RFC 8985)
+ *         It only grows with the window, a flux with a small window keeps a small tracker
+ */
+/** @var inflight::segments
+ *  Member 'segments' contains one entry for each sequence number modulo size
+ */
+/** @var inflight::acked
+ *  Member 'acked' contains a bit for each entry, set once the segment is acknowledged on its own (SACK)
+ */
+/** @var inflight::lost
+ *  Member 'lost' contains a bit for each entry, set while the segment waits to be sent again
+ */
+/** @var inflight::size
+ *  Member 'size' contains the number of entries, power of 2
+ */
+/** @var inflight::una
+ *  Member 'una' contains the oldest sequence number not acknowledged
+ */
+/** @var inflight::max
+ *  Member 'max' contains the sequence number following the last segment sent
+ */
+/** @var inflight::fack
+ *  Member 'fack' contains the sequence number following the furthest segment acknowledged
+ */
+/** @var inflight::nb_acked
+ *  Member 'nb_acked' contains the number of segments in flight acknowledged on their own
+ */
+/** @var inflight::nb_lost
+ *  Member 'nb_lost' contains the number of segments in flight marked lost
+ */
+/** @var inflight::oldest
+ *  Member 'oldest' contains the sequence number of the segment queued first, sent before every other one queued
+ */
+/** @var inflight::newest
+ *  Member 'newest' contains the sequence number of the segment queued last
+ */
+/** @var inflight::nb_queued
+ *  Member 'nb_queued' contains the number of segments queued
+ */
+struct inflight
+{
+    struct segment *segments;
+    uint64_t *acked;
+    uint64_t *lost;
+    uint32_t size;
+    uint32_t una;
+    uint32_t max;
+    uint32_t fack;
+    uint32_t nb_acked;
+    uint32_t nb_lost;
+    uint32_t oldest;
+    uint32_t newest;
+    uint32_t nb_queued;
+};
+
+/**
+ * @fn      void initInflight(struct inflight *inflight, uint32_t seq)
+ * @brief   Prepares an empty tracker, the first segment sent will be seq
+ * @param   inflight    Tracker to prepare, already allocated or zeroed
+ * @param   seq         Sequence number of the first segment
+ */
+void initInflight(struct inflight *inflight, uint32_t seq);
+
+/**
+ * @fn      void destroyInflight(struct inflight *inflight)
+ * @brief   Frees the entries of a tracker
+ * @param   inflight    Tracker to destroy
+ */
+void destroyInflight(struct inflight *inflight);
+
+/**
+ * @fn      struct segment *inflightSend(struct inflight *inflight, uint32_t seq, uint32_t now)
+ * @brief   A segment is sent, for the first time or again : it is not lost anymore
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number of the segment, before una + INFLIGHT_MAX_SIZE
+ * @param   now         Time it is sent (timestampNow)
+ * @return  Its entry
+ */
+struct segment *inflightSend(struct inflight *inflight, uint32_t seq, uint32_t now);
+
+/**
+ * @fn      struct segment *inflightGet(struct inflight *inflight, uint32_t seq)
+ * @brief   Entry of a segment in flight
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number of the segment
+ * @return  Its entry, NULL if it is not in flight
+ */
+struct segment *inflightGet(struct inflight *inflight, uint32_t seq);
+
+/**
+ * @fn      void inflightAck(struct inflight *inflight, uint32_t una)
+ * @brief   Every segment before una has been acknowledged, they leave the tracker
+ * @param   inflight    Tracker of the flux
+ * @param   una         Oldest sequence number not acknowledged
+ */
+void inflightAck(struct inflight *inflight, uint32_t una);
+
+/**
+ * @fn      uint32_t inflightSack(struct inflight *inflight, uint32_t start, uint32_t end)
+ * @brief   The segments start..end (excluded) arrived, the ones in flight are marked acknowledged and not lost
+ * @param   inflight    Tracker of the flux
+ * @param   start       First sequence number of the block
+ * @param   end         Sequence number following the block
+ * @return  The number of segments acknowledged by this block only
+ */
+uint32_t inflightSack(struct inflight *inflight, uint32_t start, uint32_t end);
+
+/**
+ * @fn      int inflightSacked(struct inflight *inflight, uint32_t seq)
+ * @brief   Checks if a segment in flight has been acknowledged on its own
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number of the segment
+ * @return  1 if it has been, else 0 (not in flight included)
+ */
+int inflightSacked(struct inflight *inflight, uint32_t seq);
+
+/**
+ * @fn      int inflightLose(struct inflight *inflight, uint32_t seq)
+ * @brief   Marks lost a segment in flight not acknowledged, until it is sent again or acknowledged
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number of the segment
+ * @return  1 if it was not marked lost yet, else 0
+ */
+int inflightLose(struct inflight *inflight, uint32_t seq);
+
+/**
+ * @fn      uint32_t inflightNextHole(struct inflight *inflight, uint32_t seq)
+ * @brief   First segment in flight not acknowledged, from seq
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number to start from
+ * @return  Its sequence number, max if there is none
+ */
+uint32_t inflightNextHole(struct inflight *inflight, uint32_t seq);
+
+/**
+ * @fn      uint32_t inflightNextLost(struct inflight *inflight, uint32_t seq)
+ * @brief   First segment in flight marked lost, from seq
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number to start from
+ * @return  Its sequence number, max if there is none
+ */
+uint32_t inflightNextLost(struct inflight *inflight, uint32_t seq);
+
+/**
+ * @fn      uint32_t inflightCount(struct inflight *inflight)
+ * @brief   Number of segments in flight
+ * @param   inflight    Tracker of the flux
+ * @return  The number of segments
+ */
+uint32_t inflightCount(struct inflight *inflight);
+
+/**
+ * @fn      uint32_t inflightPipe(struct inflight *inflight)
+ * @brief   Number of segments still in the network : in flight, neither acknowledged nor lost (pipe, RFC 6675)
+ * @param   inflight    Tracker of the flux
+ * @return  The number of segments
+ */
+uint32_t inflightPipe(struct inflight *inflight);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+/**
+ * @fn      void inflightAlloc(struct inflight *inflight, uint32_t size)
+ * @brief   Allocates the entries and the scoreboard of a tracker, the bitmaps cleared
+ * @param   inflight    Tracker of the flux
+ * @param   size        Number of entries, power of 2 and at least INFLIGHT_MIN_SIZE
+ */
+void inflightAlloc(struct inflight *inflight, uint32_t size)
+{
+    inflight->segments = malloc(sizeof(struct segment) * size);
+    inflight->acked = calloc(BITMAP_WORDS(size), sizeof(uint64_t));
+    inflight->lost = calloc(BITMAP_WORDS(size), sizeof(uint64_t));
+    if (inflight->segments == NULL || inflight->acked == NULL || inflight->lost == NULL)
+        raler("inflightAlloc");
+    inflight->size = size;
+}
+
+void initInflight(struct inflight *inflight, uint32_t seq)
+{
+    if (inflight->segments == NULL)
+        inflightAlloc(inflight, INFLIGHT_MIN_SIZE);
+    else // a new connection : nothing known about the segments of the last one
+    {
+        memset(inflight->acked, 0, BITMAP_WORDS(inflight->size) * sizeof(uint64_t));
+        memset(inflight->lost, 0, BITMAP_WORDS(inflight->size) * sizeof(uint64_t));
+    }
+    inflight->nb_acked = 0;
+    inflight->nb_lost = 0;
+    inflight->oldest = seq;
+    inflight->newest = seq;
+    inflight->nb_queued = 0;
+    inflight->una = seq;
+    inflight->max = seq;
+    inflight->fack = seq;
+}
+
+void destroyInflight(struct inflight *inflight)
+{
+    free(inflight->segments);
+    free(inflight->acked);
+    free(inflight->lost);
+    inflight->segments = NULL;
+    inflight->acked = NULL;
+    inflight->lost = NULL;
+    inflight->size = 0;
+}
+
+/**
+ * @fn      void inflightGrow(struct inflight *inflight, uint32_t needed)
+ * @brief   Doubles the number of entries until needed segments fit, the ones in flight keep their entry and bits
+ * @param   inflight    Tracker of the flux
+ * @param   needed      Number of segments to fit, at most INFLIGHT_MAX_SIZE
+ */
+void inflightGrow(struct inflight *inflight, uint32_t needed)
+{
+    uint32_t size = inflight->size;
+    while (size < needed)
+        size *= 2;
+
+    struct inflight grown = *inflight;
+    inflightAlloc(&grown, size);
+
+    // the index of a segment depends on the size : every segment in flight moves
+    for (uint32_t seq = inflight->una; seq != inflight->max; ++seq)
+    {
+        uint32_t from = seq & (inflight->size - 1), to = seq & (size - 1);
+        grown.segments[to] = inflight->segments[from];
+        bitmapFill(grown.acked, to, to + 1, bitmapTest(inflight->acked, from));
+        bitmapFill(grown.lost, to, to + 1, bitmapTest(inflight->lost, from));
+    }
+
+    destroyInflight(inflight);
+    *inflight = grown;
+}
+
+/**
+ * @fn      uint32_t inflightFill(struct inflight *inflight, uint64_t *bitmap, uint32_t start, uint32_t end, int value)
+ * @brief   Sets or clears the bits of the segments start..end (excluded) in a bitmap of the scoreboard, the ring wraps around
+ * @param   inflight    Tracker of the flux
+ * @param   bitmap      acked or lost
+ * @param   start       First sequence number, in flight
+ * @param   end         Sequence number following the last one, at most max
+ * @param   value       1 to set them, 0 to clear them
+ * @return  The number of bits which changed
+ */
+uint32_t inflightFill(struct inflight *inflight, uint64_t *bitmap, uint32_t start, uint32_t end, int value)
+{
+    uint32_t changed = 0;
+    uint32_t left = (uint32_t) seqDiff(end, start);
+    uint32_t index = start & (inflight->size - 1);
+    while (left > 0) // at most twice : up to the end of the ring, then from its beginning
+    {
+        uint32_t nb = MIN(left, inflight->size - index);
+        changed += bitmapFill(bitmap, index, index + nb, value);
+        left -= nb;
+        index = 0;
+    }
+    return changed;
+}
+
+/**
+ * @fn      uint32_t inflightFind(struct inflight *inflight, const uint64_t *bitmap, uint32_t seq, uint32_t end, int value)
+ * @brief   First segment in flight from seq and before end whose bit in a bitmap of the scoreboard is value, the ring wraps around
+ * @param   inflight    Tracker of the flux
+ * @param   bitmap      acked or lost
+ * @param   seq         Sequence number to start from
+ * @param   end         Sequence number to stop at, at most max
+ * @param   value       Bit to find
+ * @return  Its sequence number, end if there is none
+ */
+uint32_t inflightFind(struct inflight *inflight, const uint64_t *bitmap, uint32_t seq, uint32_t end, int value)
+{
+    if (seqBefore(seq, inflight->una))
+        seq = inflight->una;
+    if (!seqBefore(seq, end))
+        return end;
+
+    uint32_t left = (uint32_t) seqDiff(end, seq);
+    uint32_t index = seq & (inflight->size - 1);
+    while (left > 0) // at most twice : up to the end of the ring, then from its beginning
+    {
+        uint32_t nb = MIN(left, inflight->size - index);
+        uint32_t found = bitmapFind(bitmap, index, index + nb, value);
+        if (found < index + nb)
+            return seq + (found - index);
+        seq += nb;
+        left -= nb;
+        index = 0;
+    }
+    return end;
+}
+
+/**
+ * @fn      void inflightQueue(struct inflight *inflight, uint32_t seq)
+ * @brief   A segment in flight has just been sent : it goes at the end of the queue, after every other one
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number of the segment, not queued
+ */
+void inflightQueue(struct inflight *inflight, uint32_t seq)
+{
+    struct segment *segment = &inflight->segments[seq & (inflight->size - 1)];
+    if (inflight->nb_queued == 0)
+        inflight->oldest = seq;
+    else
+        inflight->segments[inflight->newest & (inflight->size - 1)].next = seq;
+    segment->prev = inflight->newest;
+    segment->queued = 1;
+    inflight->newest = seq;
+    inflight->nb_queued++;
+}
+
+/**
+ * @fn      void inflightUnqueue(struct inflight *inflight, uint32_t seq)
+ * @brief   A segment in flight left the network (acknowledged, lost or sent again), it leaves the queue
+ * @param   inflight    Tracker of the flux
+ * @param   seq         Sequence number of the segment, nothing if it is not queued
+ */
+void inflightUnqueue(struct inflight *inflight, uint32_t seq)
+{
+    struct segment *segment = &inflight->segments[seq & (inflight->size - 1)];
+    if (!segment->queued)
+        return;
+    if (seq == inflight->oldest)
+        inflight->oldest = segment->next;
+    else
+        inflight->segments[segment->prev & (inflight->size - 1)].next = segment->next;
+    if (seq == inflight->newest)
+        inflight->newest = segment->prev;
+    else
+        inflight->segments[segment->next & (inflight->size - 1)].prev = segment->prev;
+    segment->queued = 0;
+    inflight->nb_queued--;
+}
+
+struct segment *inflightSend(struct inflight *inflight, uint32_t seq, uint32_t now)
+{
+    uint32_t needed = (uint32_t) seqDiff(seq, inflight->una) + 1;
+    if (needed > inflight->size)
+        inflightGrow(inflight, MIN(needed, INFLIGHT_MAX_SIZE));
+
+    struct segment *segment = &inflight->segments[seq & (inflight->size - 1)];
+    if (seqBefore(seq, inflight->max)) // sent again : its last copy is the one the queue orders
+    {
+        segment->retransmits++;
+        inflightUnqueue(inflight, seq);
+    }
+    else // new segment, the ones skipped are not sent yet : nothing known about them
+    {
+        for (uint32_t skipped = inflight->max; skipped != seq; ++skipped)
+            inflight->segments[skipped & (inflight->size - 1)] = (struct segment) { 0 };
+        inflightFill(inflight, inflight->acked, inflight->max, seq + 1, 0);
+        segment->retransmits = 0;
+        segment->queued = 0;
+        inflight->max = seq + 1;
+    }
+    inflight->nb_lost -= inflightFill(inflight, inflight->lost, seq, seq + 1, 0);
+    segment->sent = now;
+    if (!bitmapTest(inflight->acked, seq & (inflight->size - 1))) // a segment already acknowledged is not in the network
+        inflightQueue(inflight, seq);
+    return segment;
+}
+
+struct segment *inflightGet(struct inflight *inflight, uint32_t seq)
+{
+    if (seqBefore(seq, inflight->una) || !seqBefore(seq, inflight->max))
+        return NULL;
+    return &inflight->segments[seq & (inflight->size - 1)];
+}
+
+void inflightAck(struct inflight *inflight, uint32_t una)
+{
+    if (seqBefore(inflight->una, una))
+    {
+        // the segments leaving the tracker leave the scoreboard too
+        uint32_t end = seqBefore(una, inflight->max) ? una : inflight->max;
+        for (uint32_t seq = inflightFind(inflight, inflight->acked, inflight->una, end, 0); seq != end;
+             seq = inflightFind(inflight, inflight->acked, seq + 1, end, 0))
+            inflightUnqueue(inflight, seq);
+        inflight->nb_acked -= inflightFill(inflight, inflight->acked, inflight->una, end, 0);
+        inflight->nb_lost -= inflightFill(inflight, inflight->lost, inflight->una, end, 0);
+        inflight->una = una;
+    }
+    if (seqBefore(inflight->max, una))
+        inflight->max = una;
+    if (seqBefore(inflight->fack, una))
+        inflight->fack = una;
+}
+
+uint32_t inflightSack(struct inflight *inflight, uint32_t start, uint32_t end)
+{
+    // only the part of the block still in flight
+    if (seqBefore(start, inflight->una))
+        start = inflight->una;
+    if (seqBefore(inflight->max, end))
+        end = inflight->max;
+    if (!seqBefore(start, end))
+        return 0;
+
+    // the holes of the block leave the queue, the segments already acknowledged are not in it
+    for (uint32_t seq = inflightFind(inflight, inflight->acked, start, end, 0); seq != end;
+         seq = inflightFind(inflight, inflight->acked, seq + 1, end, 0))
+        inflightUnqueue(inflight, seq);
+
+    inflight->nb_lost -= inflightFill(inflight, inflight->lost, start, end, 0);
+    if (seqBefore(inflight->fack, end))
+        inflight->fack = end;
+    uint32_t acked = inflightFill(inflight, inflight->acked, start, end, 1);
+    inflight->nb_acked += acked;
+    return acked;
+}
+
+int inflightSacked(struct inflight *inflight, uint32_t seq)
+{
+    if (inflightGet(inflight, seq) == NULL)
+        return 0;
+    return bitmapTest(inflight->acked, seq & (inflight->size - 1));
+}
+
+int inflightLose(struct inflight *inflight, uint32_t seq)
+{
+    if (inflightGet(inflight, seq) == NULL || inflightSacked(inflight, seq))
+        return 0;
+    uint32_t changed = inflightFill(inflight, inflight->lost, seq, seq + 1, 1);
+    inflight->nb_lost += changed;
+    inflightUnqueue(inflight, seq); // back in the queue once it is sent again
+    return (int) changed;
+}
+
+uint32_t inflightNextHole(struct inflight *inflight, uint32_t seq)
+{
+    return inflightFind(inflight, inflight->acked, seq, inflight->max, 0);
+}
+
+uint32_t inflightNextLost(struct inflight *inflight, uint32_t seq)
+{
+    return inflightFind(inflight, inflight->lost, seq, inflight->max, 1);
+}
+
+uint32_t inflightCount(struct inflight *inflight)
+{
+    return (uint32_t) seqDiff(inflight->max, inflight->una);
+}
+
+uint32_t inflightPipe(struct inflight *inflight)
+{
+    return inflightCount(inflight) - inflight->nb_acked - inflight->nb_lost;
+}
+
+#endif //_INFLIGHT_H
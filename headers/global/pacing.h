@@ -0,0 +1,141 @@
+#ifndef _PACING_H
+#define _PACING_H
+
+#define PACING_MIN_BURST 2 // segments a flux may always send back to back
+#define PACING_BURST_TIME (2 * TIMER_TICK) // credit of a flux, in microseconds : the wheel wakes it up once a tick at best
+
+/** @enum pacing_mode
+ *  @brief This enum describes who holds the segments of a flux until their time comes
+ */
+enum pacing_mode
+{
+    PACING_NONE = 0,    /**< the whole window leaves at once */
+    PACING_BUCKET = 1,  /**< the loop holds them, a token bucket refilled at the pacing rate */
+    PACING_TXTIME = 2   /**< the kernel holds them (SO_TXTIME), each packet carries the time it leaves at */
+};
+typedef enum pacing_mode pacing_mode_t;
+
+/** @struct pacer
+ *  @brief Pace of a flux : its segments leave one interval apart, an idle flux may send a short burst at once
+ */
+/** @var pacer::mode
+ *  Member 'mode' tells who holds the segments
+ */
+/** @var pacer::rate
+ *  Member 'rate' contains the rate given by the congestion control, in packets per second (0 : not paced)
+ */
+/** @var pacer::interval
+ *  Member 'interval' contains the time between two segments, in nanoseconds
+ */
+/** @var pacer::next
+ *  Member 'next' contains the time the next segment can leave at (CLOCK_MONOTONIC, in nanoseconds)
+ */
+struct pacer
+{
+    pacing_mode_t mode;
+    uint64_t rate;
+    uint64_t interval;
+    uint64_t next;
+};
+
+/**
+ * @fn      pacing_mode_t parsePacing(const char *name)
+ * @brief   Finds a pacing mode from its name
+ * @param   name    Name chosen by the user ('bucket' or 'txtime')
+ * @return  The mode, PACING_NONE if it doesn't exist
+ */
+pacing_mode_t parsePacing(const char *name);
+
+/**
+ * @fn      void initPacer(struct pacer *pacer, pacing_mode_t mode)
+ * @brief   Prepares the pace of a flux, not paced until it knows its rate
+ * @param   pacer   Pace to prepare
+ * @param   mode    Who holds the segments
+ */
+void initPacer(struct pacer *pacer, pacing_mode_t mode);
+
+/**
+ * @fn      void pacerRate(struct pacer *pacer, uint64_t rate)
+ * @brief   Changes the rate of a flux, the segments already booked keep their time
+ * @param   pacer   Pace of the flux
+ * @param   rate    Rate in packets per second, 0 : not paced
+ */
+void pacerRate(struct pacer *pacer, uint64_t rate);
+
+/**
+ * @fn      int pacerHolds(struct pacer *pacer)
+ * @brief   Tells if the next segment has to wait in the loop (PACING_BUCKET)
+ * @param   pacer   Pace of the flux
+ * @return  1 if it has to wait until pacerWake, else 0
+ */
+int pacerHolds(struct pacer *pacer);
+
+/**
+ * @fn      uint64_t pacerSend(struct pacer *pacer)
+ * @brief   Books the time of a segment sent
+ * @param   pacer   Pace of the flux
+ * @return  The time the kernel releases it (PACING_TXTIME, CLOCK_MONOTONIC, in nanoseconds), 0 : right away
+ */
+uint64_t pacerSend(struct pacer *pacer);
+
+/**
+ * @fn      uint64_t pacerWake(struct pacer *pacer)
+ * @brief   Time the segment held back can leave at
+ * @param   pacer   Pace of the flux
+ * @return  The time, in microseconds (monotonicTime)
+ */
+uint64_t pacerWake(struct pacer *pacer);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+pacing_mode_t parsePacing(const char *name)
+{
+    if (strcmp(name, "bucket") == 0)
+        return PACING_BUCKET;
+    if (strcmp(name, "txtime") == 0)
+        return PACING_TXTIME;
+    return PACING_NONE;
+}
+
+void initPacer(struct pacer *pacer, pacing_mode_t mode)
+{
+    pacer->mode = mode;
+    pacer->rate = 0;
+    pacer->interval = 0;
+    pacer->next = 0;
+}
+
+void pacerRate(struct pacer *pacer, uint64_t rate)
+{
+    pacer->rate = pacer->mode == PACING_NONE ? 0 : rate;
+    pacer->interval = pacer->rate == 0 ? 0 : 1000000000 / pacer->rate;
+}
+
+int pacerHolds(struct pacer *pacer)
+{
+    return pacer->mode == PACING_BUCKET && pacer->rate != 0 && pacer->next > monotonicTime() * 1000;
+}
+
+uint64_t pacerSend(struct pacer *pacer)
+{
+    if (pacer->rate == 0)
+        return 0;
+
+    // the tokens a flux saved while it had nothing to send are capped : a few segments, or what a tick lets through
+    uint64_t now = monotonicTime() * 1000;
+    uint64_t credit = MAX(PACING_MIN_BURST * pacer->interval, (uint64_t) PACING_BURST_TIME * 1000);
+    uint64_t start = MAX(pacer->next, now > credit ? now - credit : 0);
+    pacer->next = start + pacer->interval;
+
+    // the segments of a burst leave right away, all at the same time : they can share a datagram (UDP_SEGMENT)
+    return pacer->mode == PACING_TXTIME ? MAX(start, now) : 0;
+}
+
+uint64_t pacerWake(struct pacer *pacer)
+{
+    return (pacer->next + 999) / 1000;
+}
+
+#endif //_PACING_H
@@ -1,7 +1,16 @@
 #ifndef _PACKET_H
 #define _PACKET_H
 
-#define PACKET_DATA_SIZE 44
+#include <stddef.h>
+
+#define PACKET_HEADER_SIZE 26 // idFlux, type, ECN, numSequence, numAcquittement, horodatage, echoHorodatage, tailleFenetre, tailleDonnees
+#define PACKET_MAX_SIZE 65507 // biggest UDP payload over IPv4
+#define PACKET_MAX_DATA_SIZE (PACKET_MAX_SIZE - PACKET_HEADER_SIZE)
+#define PACKET_DEFAULT_MSS 44 // data size used when the peer doesn't announce its MSS
+#define PACKET_OPTIONS_SIZE 64 // room for the options carried by control packets (MSS, SACK)
+#define PACKET_CONTROL_SIZE (PACKET_HEADER_SIZE + PACKET_OPTIONS_SIZE) // biggest packet without data
+#define PACKET_MAX_FLUX (UINT16_MAX + 1) // idFlux goes from 0 to UINT16_MAX
+#define PACKET_SACK_BLOCKS 4 // most SACK blocks carried by an ACK
 
 uint8_t ACK = 0x10;
 uint8_t RST = 0x04;
@@ -15,56 +24,72 @@ uint8_t ECN_DISABLED = 0x00;
  *  @brief This structure is a TCP packet
  */
 /** @var packet::idFlux
- *  Member 'idFlux' contains the packet's ID
+ *  Member 'idFlux' contains the packet's ID, up to PACKET_MAX_FLUX fluxes
  */
 /** @var packet::type
  *  Member 'type' contains the packet's type (ACK, RST, FIN, SYN)
  */
-/** @var packet::numSequence
-*  Member 'numSequence' contains the packet's sequence number
-*/
-/** @var packet::numAcquittement
- *  Member 'numAcquittement' contains the packet's acquittal number
- */
 /** @var packet::ECN
 *  Member 'ECN' contains the packet's ECN bit (true, false)
 */
 /** @var packet::tailleFenetre
- *  Member 'tailleFenetre' contains the packet's size
+ *  Member 'tailleFenetre' contains the size of the window of the source, in packets
+ */
+/** @var packet::numSequence
+*  Member 'numSequence' contains the packet's sequence number, compared with serial number arithmetic
+*/
+/** @var packet::numAcquittement
+ *  Member 'numAcquittement' contains the packet's acquittal number, compared with serial number arithmetic
+ */
+/** @var packet::horodatage
+ *  Member 'horodatage' contains the time the packet has been sent (timestampNow), 0 if not timed
+ */
+/** @var packet::echoHorodatage
+ *  Member 'echoHorodatage' contains the horodatage of the packet an ACK answers, the source measures the RTT with it
+ */
+/** @var packet::tailleDonnees
+ *  Member 'tailleDonnees' contains the size of the packet's data
  */
 /** @var packet::data
-*  Member 'data' contains the packet's data
+*  Member 'data' contains the packet's data (binary, tailleDonnees bytes), at most the negotiated MSS
+*  SYN and SYN|ACK packets carry the MSS they announce here (uint16_t), ACKs their SACK blocks (struct sack)
 */
 struct packet
 {
-    uint8_t idFlux;
+    uint16_t idFlux;
     uint8_t type;
-    uint16_t numSequence;
-    uint16_t numAcquittement;
     uint8_t ECN;
-    uint8_t tailleFenetre;
-    char data[PACKET_DATA_SIZE];
+    uint32_t numSequence;
+    uint32_t numAcquittement;
+    uint32_t horodatage;
+    uint32_t echoHorodatage;
+    uint32_t tailleFenetre;
+    uint16_t tailleDonnees;
+    char data[PACKET_MAX_DATA_SIZE];
 };
 typedef struct packet *packet_t;
+_Static_assert(offsetof(struct packet, data) == PACKET_HEADER_SIZE, "PACKET_HEADER_SIZE doesn't match struct packet");
 
-/**
- * @fn      packet_t newPacket()
- * @brief   Allocates a packet structure
- * @return  Packet created
+/** @struct sack
+ *  @brief This structure is a SACK block : packets received after a gap, the ACK only acknowledges up to it
  */
-packet_t newPacket();
-
-/**
- * @fn      void destroyPacket(packet_t packet)
- * @brief   Destroys packet, frees structure
- * @param   packet  Packet to destroy
+/** @var sack::start
+ *  Member 'start' contains the sequence number of the first packet of the block
  */
-void destroyPacket(packet_t packet);
+/** @var sack::end
+ *  Member 'end' contains the sequence number following the last packet of the block
+ */
+struct sack
+{
+    uint32_t start;
+    uint32_t end;
+};
+_Static_assert(PACKET_SACK_BLOCKS * sizeof(struct sack) <= PACKET_OPTIONS_SIZE, "SACK blocks don't fit in the options");
 
 /**
- * @fn      int setPacket(packet_t packet, uint8_t idFlux, uint8_t type, uint16_t seq,
-                   uint16_t acq, uint8_t ECN, uint8_t size, char *data)
- * @brief   Inserts given values into a packet
+ * @fn      int setPacket(packet_t packet, uint16_t idFlux, uint8_t type, uint32_t seq,
+                   uint32_t acq, uint8_t ECN, uint32_t size, const char *data, uint16_t len)
+ * @brief   Inserts given values into a packet, data is copied as is (binary safe)
  * @param   packet  packet to set
  * @param   idFlux  packet's flux ID
  * @param   type    packet's type
@@ -73,10 +98,112 @@ void destroyPacket(packet_t packet);
  * @param   ECN     packet's ECN bit
  * @param   size    packet's size
  * @param   data    packet's data
+ * @param   len     size of the data
  * @return  -1 if an error has occurred, else 0
  */
-int setPacket(packet_t packet, uint8_t idFlux, uint8_t type, uint16_t seq,
-                   uint16_t acq, uint8_t ECN, uint8_t size, char *data);
+int setPacket(packet_t packet, uint16_t idFlux, uint8_t type, uint32_t seq,
+                   uint32_t acq, uint8_t ECN, uint32_t size, const char *data, uint16_t len);
+
+/**
+ * @fn      void setHeader(packet_t packet, uint16_t idFlux, uint8_t type, uint32_t seq,
+                   uint32_t acq, uint8_t ECN, uint32_t size, uint16_t len)
+ * @brief   Inserts given values into a packet header only, its data is sent from elsewhere (see sendSegments)
+ * @param   packet  packet to set
+ * @param   idFlux  packet's flux ID
+ * @param   type    packet's type
+ * @param   seq     packet's sequence number
+ * @param   acq     packet's acquittal number
+ * @param   ECN     packet's ECN bit
+ * @param   size    packet's size
+ * @param   len     size of the data that will follow the header
+ */
+void setHeader(packet_t packet, uint16_t idFlux, uint8_t type, uint32_t seq,
+               uint32_t acq, uint8_t ECN, uint32_t size, uint16_t len);
+
+/**
+ * @fn      void setTimestamp(packet_t packet, uint32_t horodatage, uint32_t echo)
+ * @brief   Inserts the timestamps of a packet, setHeader clears them
+ * @param   packet      packet to set
+ * @param   horodatage  time the packet is sent (timestampNow)
+ * @param   echo        horodatage of the packet we answer
+ */
+void setTimestamp(packet_t packet, uint32_t horodatage, uint32_t echo);
+
+/**
+ * @fn      void setSack(packet_t packet, const struct sack *blocks, int nb)
+ * @brief   Inserts SACK blocks in an ACK, they replace its data
+ * @param   packet  ACK to set
+ * @param   blocks  SACK blocks, the most recent first
+ * @param   nb      Number of blocks, at most PACKET_SACK_BLOCKS
+ */
+void setSack(packet_t packet, const struct sack *blocks, int nb);
+
+/**
+ * @fn      int getSack(packet_t packet, struct sack *blocks)
+ * @brief   Reads the SACK blocks of an ACK
+ * @param   packet  ACK received
+ * @param   blocks  Filled with the blocks, room for PACKET_SACK_BLOCKS
+ * @return  The number of blocks
+ */
+int getSack(packet_t packet, struct sack *blocks);
+
+/**
+ * @fn      uint32_t timestampNow()
+ * @brief   Current time carried by the packets, in microseconds : it wraps around, only differences matter
+ * @return  The timestamp, never 0 (not timed)
+ */
+uint32_t timestampNow();
+
+/**
+ * @fn      int decodePacket(packet_t packet, int len)
+ * @brief   Checks a packet received from the network against the size of its datagram
+ * @param   packet  Packet received
+ * @param   len     Size of the datagram
+ * @return  -1 if the packet is malformed (too short, data size bigger than the datagram), else 0
+ */
+int decodePacket(packet_t packet, int len);
+
+/**
+ * @fn      int packetSize(packet_t packet)
+ * @brief   Size of a packet on the wire : header and data
+ * @param   packet  Packet to measure
+ * @return  Number of bytes to send
+ */
+int packetSize(packet_t packet);
+
+/**
+ * @fn      int getMss(packet_t packet, int mss)
+ * @brief   Reads the MSS announced in a SYN or SYN|ACK packet
+ * @param   packet  SYN or SYN|ACK packet
+ * @param   mss     Local MSS, the result never goes beyond it
+ * @return  The MSS both sides agree on
+ */
+int getMss(packet_t packet, int mss);
+
+/**
+ * @fn      int32_t seqDiff(uint32_t a, uint32_t b)
+ * @brief   Distance between two sequence numbers, the sequence space wraps around (RFC 1982)
+ * @param   a       Sequence number
+ * @param   b       Sequence number
+ * @return  a - b, negative if a is before b
+ */
+int32_t seqDiff(uint32_t a, uint32_t b);
+
+/**
+ * @fn      int seqBefore(uint32_t a, uint32_t b)
+ * @brief   Checks if a sequence number comes before another one, the sequence space wraps around
+ * @param   a       Sequence number
+ * @param   b       Sequence number
+ * @return  1 if a < b, else 0
+ */
+int seqBefore(uint32_t a, uint32_t b);
+
+/**
+ * @fn      uint32_t randomSeq()
+ * @brief   Picks a random initial sequence number, anywhere in the sequence space
+ * @return  The sequence number
+ */
+uint32_t randomSeq();
 
 /**
  * @fn      void showPacket(packet_t packet)
@@ -89,21 +216,20 @@ void showPacket(packet_t packet);
 /* FUNCTIONS */
 /*///////////*/
 
-packet_t newPacket()
+int setPacket(packet_t packet, uint16_t idFlux, uint8_t type, uint32_t seq,
+              uint32_t acq, uint8_t ECN, uint32_t size, const char *data, uint16_t len)
 {
-    packet_t packet = malloc(sizeof(struct packet));
-    if(packet == NULL)
-        raler("newPacket");
-    return packet;
-}
+    if(len > PACKET_MAX_DATA_SIZE)
+        return -1;
 
-void destroyPacket(packet_t packet)
-{
-    free(packet);
+    setHeader(packet, idFlux, type, seq, acq, ECN, size, len);
+    memcpy(packet->data, data, len);
+
+    return 0;
 }
 
-int setPacket(packet_t packet, uint8_t idFlux, uint8_t type, uint16_t seq,
-              uint16_t acq, uint8_t ECN, uint8_t size, char *data)
+void setHeader(packet_t packet, uint16_t idFlux, uint8_t type, uint32_t seq,
+               uint32_t acq, uint8_t ECN, uint32_t size, uint16_t len)
 {
     packet->idFlux = idFlux;
     packet->type = type;
@@ -111,24 +237,89 @@ int setPacket(packet_t packet, uint8_t idFlux, uint8_t type, uint16_t seq,
     packet->numAcquittement = acq;
     packet->ECN = ECN;
     packet->tailleFenetre = size;
+    packet->tailleDonnees = len;
+    packet->horodatage = 0;
+    packet->echoHorodatage = 0;
+}
 
-    int r;
-    if((r = snprintf(packet->data, 44, "%s", data)) >= 44 || r < 0)
-        return -1;
+void setTimestamp(packet_t packet, uint32_t horodatage, uint32_t echo)
+{
+    packet->horodatage = horodatage;
+    packet->echoHorodatage = echo;
+}
+
+void setSack(packet_t packet, const struct sack *blocks, int nb)
+{
+    memcpy(packet->data, blocks, sizeof(struct sack) * nb);
+    packet->tailleDonnees = (uint16_t) (sizeof(struct sack) * nb);
+}
 
+int getSack(packet_t packet, struct sack *blocks)
+{
+    int nb = MIN(packet->tailleDonnees / sizeof(struct sack), PACKET_SACK_BLOCKS);
+    memcpy(blocks, packet->data, sizeof(struct sack) * nb);
+    return nb;
+}
+
+uint32_t timestampNow()
+{
+    uint32_t now = (uint32_t) monotonicTime(); // wraps around every ~71 minutes
+    return now == 0 ? 1 : now;
+}
+
+int decodePacket(packet_t packet, int len)
+{
+    if(len < PACKET_HEADER_SIZE || packet->tailleDonnees > len - PACKET_HEADER_SIZE)
+        return -1;
     return 0;
 }
 
+int packetSize(packet_t packet)
+{
+    return PACKET_HEADER_SIZE + packet->tailleDonnees;
+}
+
+int getMss(packet_t packet, int mss)
+{
+    uint16_t announced = 0;
+    if(packet->tailleDonnees >= sizeof(announced))
+        memcpy(&announced, packet->data, sizeof(announced));
+
+    // nothing announced : the peer only knows the historical data size
+    if(announced == 0)
+        announced = PACKET_DEFAULT_MSS;
+
+    return MIN(announced, mss);
+}
+
+int32_t seqDiff(uint32_t a, uint32_t b)
+{
+    return (int32_t) (a - b); // unsigned subtraction wraps, the cast gives the shortest way around
+}
+
+int seqBefore(uint32_t a, uint32_t b)
+{
+    return seqDiff(a, b) < 0;
+}
+
+uint32_t randomSeq()
+{
+    return ((uint32_t) rand() << 16) ^ (uint32_t) rand(); // rand() only gives 31 bits
+}
+
 void showPacket(packet_t packet)
 {
     printf("\n========= NEW PACKET =========\n");
     printf("Packet idFlux : %d\n", packet->idFlux);
     printf("Packet type : %d\n", packet->type);
-    printf("Packet numSequence : %d\n", packet->numSequence);
-    printf("Packet numAcquittement : %d\n", packet->numAcquittement);
+    printf("Packet numSequence : %u\n", packet->numSequence);
+    printf("Packet numAcquittement : %u\n", packet->numAcquittement);
+    printf("Packet horodatage : %u\n", packet->horodatage);
+    printf("Packet echoHorodatage : %u\n", packet->echoHorodatage);
     printf("Packet ECN : %d\n", packet->ECN);
-    printf("Packet tailleFenetre : %d\n", packet->tailleFenetre);
-    printf("Packet data : %s\n", packet->data);
+    printf("Packet tailleFenetre : %u\n", packet->tailleFenetre);
+    printf("Packet tailleDonnees : %d\n", packet->tailleDonnees);
+    printf("Packet data : %.*s\n", packet->tailleDonnees, packet->data);
     printf("==============================\n\n");
 }
 
@@ -0,0 +1,148 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#define POOL_CACHE_LINE 64 // every packet starts on its own cache line
+#define POOL_NONE UINT32_MAX // handle of no packet
+
+/** @struct pool
+ *  @brief Slab of packets of the same size owned by a single thread, taken and given back by handle without the allocator
+ */
+/** @var pool::slab
+ *  Member 'slab' contains the packets, one after the other, aligned on a cache line
+ */
+/** @var pool::stride
+ *  Member 'stride' contains the distance between two packets, a multiple of POOL_CACHE_LINE
+ */
+/** @var pool::size
+ *  Member 'size' contains the number of packets of the slab
+ */
+/** @var pool::nb_free
+ *  Member 'nb_free' contains the number of packets nobody holds
+ */
+/** @var pool::free
+ *  Member 'free' is a stack of the handles nobody holds, the last one given back is the first one taken (still in the cache)
+ */
+struct pool
+{
+    char *slab;
+    size_t stride;
+    uint32_t size;
+    uint32_t nb_free;
+    uint32_t *free;
+};
+typedef struct pool *pool_t;
+
+/**
+ * @fn      pool_t newPool(uint32_t size, int dataSize)
+ * @brief   Allocates a pool, every packet is free
+ * @param   size        Number of packets of the pool
+ * @param   dataSize    Max size of the data each packet will carry
+ * @return  Pool created
+ */
+pool_t newPool(uint32_t size, int dataSize);
+
+/**
+ * @fn      void destroyPool(pool_t pool)
+ * @brief   Destroys a pool and every packet of it, held or not
+ * @param   pool    Pool to destroy
+ */
+void destroyPool(pool_t pool);
+
+/**
+ * @fn      uint32_t poolAlloc(pool_t pool, uint32_t *handles, uint32_t nb)
+ * @brief   Takes up to nb packets from a pool, neighbours in the slab when the pool has just been created
+ * @param   pool        Pool to take from
+ * @param   handles     Filled with the handle of each packet taken
+ * @param   nb          Number of packets wanted
+ * @return  The number of packets taken, less than nb if the pool runs out
+ */
+uint32_t poolAlloc(pool_t pool, uint32_t *handles, uint32_t nb);
+
+/**
+ * @fn      void poolFree(pool_t pool, const uint32_t *handles, uint32_t nb)
+ * @brief   Gives packets back to their pool, the handles are not valid anymore
+ * @param   pool        Pool the packets have been taken from
+ * @param   handles     Handles of the packets
+ * @param   nb          Number of packets
+ */
+void poolFree(pool_t pool, const uint32_t *handles, uint32_t nb);
+
+/**
+ * @fn      uint32_t poolPackets(pool_t pool, packet_t *packets, uint32_t nb)
+ * @brief   Takes up to nb packets from a pool for good, until the pool is destroyed
+ * @param   pool        Pool to take from
+ * @param   packets     Filled with each packet taken
+ * @param   nb          Number of packets wanted
+ * @return  The number of packets taken, less than nb if the pool runs out
+ */
+uint32_t poolPackets(pool_t pool, packet_t *packets, uint32_t nb);
+
+/**
+ * @fn      packet_t poolPacket(pool_t pool, uint32_t handle)
+ * @brief   Gives the packet of a handle
+ * @param   pool        Pool the packet has been taken from
+ * @param   handle      Handle of the packet
+ * @return  The packet
+ */
+packet_t poolPacket(pool_t pool, uint32_t handle);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+pool_t newPool(uint32_t size, int dataSize)
+{
+    pool_t pool = malloc(sizeof(struct pool));
+    if(pool == NULL)
+        raler("newPool");
+
+    // header + data, rounded up to a cache line : two packets never share one
+    pool->stride = (PACKET_HEADER_SIZE + dataSize + POOL_CACHE_LINE - 1) & ~((size_t) POOL_CACHE_LINE - 1);
+    pool->size = size;
+    pool->slab = aligned_alloc(POOL_CACHE_LINE, pool->stride * size);
+    pool->free = malloc(sizeof(uint32_t) * size);
+    if(pool->slab == NULL || pool->free == NULL)
+        raler("newPool");
+
+    // the first packets of the slab on top : a batch taken from a new pool is contiguous
+    for(uint32_t i = 0; i < size; ++i)
+        pool->free[i] = size - 1 - i;
+    pool->nb_free = size;
+    return pool;
+}
+
+void destroyPool(pool_t pool)
+{
+    free(pool->slab);
+    free(pool->free);
+    free(pool);
+}
+
+uint32_t poolAlloc(pool_t pool, uint32_t *handles, uint32_t nb)
+{
+    nb = MIN(nb, pool->nb_free);
+    for(uint32_t i = 0; i < nb; ++i)
+        handles[i] = pool->free[--pool->nb_free];
+    return nb;
+}
+
+void poolFree(pool_t pool, const uint32_t *handles, uint32_t nb)
+{
+    for(uint32_t i = 0; i < nb; ++i)
+        pool->free[pool->nb_free++] = handles[i];
+}
+
+uint32_t poolPackets(pool_t pool, packet_t *packets, uint32_t nb)
+{
+    nb = MIN(nb, pool->nb_free);
+    for(uint32_t i = 0; i < nb; ++i)
+        packets[i] = poolPacket(pool, pool->free[--pool->nb_free]);
+    return nb;
+}
+
+packet_t poolPacket(pool_t pool, uint32_t handle)
+{
+    return (packet_t) (pool->slab + pool->stride * handle);
+}
+
+#endif //_POOL_H
@@ -0,0 +1,141 @@
+#ifndef _RACK_H
+#define _RACK_H
+
+#define RACK_REORDER_DIVISOR 4 // reordering window : a quarter of the smoothed RTT (RFC 8985)
+
+/** @struct rack
+ *  @brief Time based loss detection of a flux (RACK, RFC 8985) : a segment sent long enough before one that
+ *         has been delivered is lost, however few segments have been acknowledged after it
+ */
+/** @var rack::sent
+ *  Member 'sent' contains the time the last segment sent among the ones delivered has been sent (timestampNow)
+ */
+/** @var rack::seq
+ *  Member 'seq' contains its sequence number, the segments sent at the same time before it are older
+ */
+/** @var rack::rtt
+ *  Member 'rtt' contains its RTT, in microseconds
+ */
+/** @var rack::deadline
+ *  Member 'deadline' contains the time the next hole can be marked lost (timestampNow), while waiting is set
+ */
+/** @var rack::valid
+ *  Member 'valid' is set once a segment has been delivered
+ */
+/** @var rack::waiting
+ *  Member 'waiting' is set while a hole sent before the last segment delivered waits for its reordering window
+ */
+struct rack
+{
+    uint32_t sent;
+    uint32_t seq;
+    uint32_t rtt;
+    uint32_t deadline;
+    int valid;
+    int waiting;
+};
+
+/**
+ * @fn      void initRack(struct rack *rack)
+ * @brief   Prepares the loss detection of a connection, nothing delivered yet
+ * @param   rack    Loss detection to prepare
+ */
+void initRack(struct rack *rack);
+
+/**
+ * @fn      void rackDelivered(struct rack *rack, uint32_t seq, uint32_t sent, uint32_t now)
+ * @brief   A segment arrived, the copy sent at sent (echoHorodatage of its ACK)
+ * @param   rack    Loss detection of the flux
+ * @param   seq     Sequence number of the segment
+ * @param   sent    Time the copy which arrived has been sent (timestampNow)
+ * @param   now     Time the ACK has been received (timestampNow)
+ */
+void rackDelivered(struct rack *rack, uint32_t seq, uint32_t sent, uint32_t now);
+
+/**
+ * @fn      uint32_t rackDetect(struct rack *rack, struct inflight *inflight, const struct rtt *rtt, uint32_t now)
+ * @brief   Marks lost the segments in the network sent before the last segment delivered by more than its RTT and
+ *          the reordering window, the lost segments sent again included : oldest first, until one is not late
+ * @param   rack        Loss detection of the flux
+ * @param   inflight    Tracker of the flux
+ * @param   rtt         RTT estimation of the flux, gives the reordering window
+ * @param   now         Current time (timestampNow)
+ * @return  The number of segments marked lost
+ */
+uint32_t rackDetect(struct rack *rack, struct inflight *inflight, const struct rtt *rtt, uint32_t now);
+
+/**
+ * @fn      uint64_t rackTimeout(struct rack *rack, uint32_t now)
+ * @brief   Time until the next hole can be marked lost (reordering timer)
+ * @param   rack    Loss detection of the flux
+ * @param   now     Current time (timestampNow)
+ * @return  The timeout, in microseconds, 0 if no hole waits
+ */
+uint64_t rackTimeout(struct rack *rack, uint32_t now);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+void initRack(struct rack *rack)
+{
+    rack->sent = 0;
+    rack->seq = 0;
+    rack->rtt = 0;
+    rack->deadline = 0;
+    rack->valid = 0;
+    rack->waiting = 0;
+}
+
+void rackDelivered(struct rack *rack, uint32_t seq, uint32_t sent, uint32_t now)
+{
+    // only the segment sent last matters : the ones sent before it and still missing are late
+    int32_t newer = (int32_t) (sent - rack->sent);
+    if (rack->valid && (newer < 0 || (newer == 0 && !seqBefore(rack->seq, seq))))
+        return;
+
+    rack->sent = sent;
+    rack->seq = seq;
+    rack->rtt = now - sent;
+    rack->valid = 1;
+}
+
+uint32_t rackDetect(struct rack *rack, struct inflight *inflight, const struct rtt *rtt, uint32_t now)
+{
+    rack->waiting = 0;
+    if (!rack->valid)
+        return 0;
+
+    uint32_t reorder = rtt->measured ? rtt->srtt / RACK_REORDER_DIVISOR : 0;
+    uint32_t lost = 0;
+
+    // sent again or not, a hole is judged by the time of its last copy : the queue is in the order they have been sent
+    while (inflight->nb_queued > 0)
+    {
+        uint32_t seq = inflight->oldest;
+        struct segment *segment = inflightGet(inflight, seq);
+        int32_t before = (int32_t) (rack->sent - segment->sent);
+        if (before < 0 || (before == 0 && !seqBefore(seq, rack->seq))) // not sent before the last one delivered, nor are the next ones
+            break;
+
+        uint32_t deadline = segment->sent + rack->rtt + reorder;
+        if ((int32_t) (now - deadline) < 0) // the next ones have been sent later : their deadline comes later too
+        {
+            rack->deadline = deadline;
+            rack->waiting = 1;
+            break;
+        }
+        lost += (uint32_t) inflightLose(inflight, seq); // it leaves the queue
+    }
+    return lost;
+}
+
+uint64_t rackTimeout(struct rack *rack, uint32_t now)
+{
+    if (!rack->waiting)
+        return 0;
+    int32_t left = (int32_t) (rack->deadline - now);
+    return left > 0 ? (uint64_t) left : 1;
+}
+
+#endif //_RACK_H
@@ -0,0 +1,215 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#define RING_SIZE 4096 // slots of a ring by default, power of 2
+#define RING_CACHE_LINE 64 // head and tail are kept apart to avoid false sharing
+
+/** @struct ring
+ *  @brief Lock-free ring of fixed size slots, one thread pushes (producer) and one thread pops (consumer)
+ */
+/** @var ring::head
+ *  Member 'head' is the next slot to pop, only written by the consumer
+ */
+/** @var ring::tail
+ *  Member 'tail' is the next slot to push, only written by the producer
+ */
+/** @var ring::parked
+ *  Member 'parked' is set while the consumer sleeps on the eventfd, the producer only wakes it up then
+ */
+/** @var ring::eventfd
+ *  Member 'eventfd' is used to wake the consumer up
+ */
+/** @var ring::size
+ *  Member 'size' contains the number of slots, power of 2
+ */
+/** @var ring::slotSize
+ *  Member 'slotSize' contains the size of a slot
+ */
+/** @var ring::slots
+ *  Member 'slots' contains size slots of slotSize bytes
+ */
+struct ring
+{
+    _Alignas(RING_CACHE_LINE) atomic_uint head;
+    _Alignas(RING_CACHE_LINE) atomic_uint tail;
+    _Alignas(RING_CACHE_LINE) atomic_int parked;
+    int eventfd;
+    unsigned int size;
+    size_t slotSize;
+    char *slots;
+};
+typedef struct ring *ring_t;
+
+/**
+ * @fn      ring_t newRing(unsigned int size, size_t slotSize)
+ * @brief   Allocates an empty ring
+ * @param   size        Number of slots, power of 2 (RING_SIZE usually)
+ * @param   slotSize    Size of a slot
+ * @return  Ring created
+ */
+ring_t newRing(unsigned int size, size_t slotSize);
+
+/**
+ * @fn      void destroyRing(ring_t ring)
+ * @brief   Destroys a ring, frees structure and closes its eventfd
+ * @param   ring    Ring to destroy
+ */
+void destroyRing(ring_t ring);
+
+/**
+ * @fn      int ringPush(ring_t ring, const void *data, size_t len)
+ * @brief   Copies data in the next slot (producer side), wakes the consumer up if it is parked
+ * @param   ring    Ring to push into
+ * @param   data    Data to copy
+ * @param   len     Size of the data, cut to the size of a slot
+ * @return  -1 if the ring is full, else 0
+ */
+int ringPush(ring_t ring, const void *data, size_t len);
+
+/**
+ * @fn      int ringPop(ring_t ring, void *data)
+ * @brief   Copies the oldest slot out of the ring (consumer side)
+ * @param   ring    Ring to pop from
+ * @param   data    Filled with the slot, slotSize bytes
+ * @return  -1 if the ring is empty, else 0
+ */
+int ringPop(ring_t ring, void *data);
+
+/**
+ * @fn      void *ringFront(ring_t ring)
+ * @brief   Gives the oldest slot without copying it (consumer side), it stays ours until ringRelease
+ * @param   ring    Ring to pop from
+ * @return  The slot, NULL if the ring is empty
+ */
+void *ringFront(ring_t ring);
+
+/**
+ * @fn      void ringRelease(ring_t ring)
+ * @brief   Gives the slot returned by ringFront back to the producer (consumer side)
+ * @param   ring    Ring popped from
+ */
+void ringRelease(ring_t ring);
+
+/**
+ * @fn      int ringPark(ring_t ring)
+ * @brief   Tells the producer we are about to sleep on ring->eventfd (consumer side)
+ * @param   ring    Ring to park on
+ * @return  1 if the ring is not empty : we are not parked and must not sleep, else 0
+ */
+int ringPark(ring_t ring);
+
+/**
+ * @fn      void ringUnpark(ring_t ring)
+ * @brief   Stops the parking started by ringPark once we are awake (consumer side)
+ * @param   ring    Ring parked on
+ */
+void ringUnpark(ring_t ring);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+ring_t newRing(unsigned int size, size_t slotSize)
+{
+    ring_t ring = aligned_alloc(RING_CACHE_LINE, sizeof(struct ring));
+    if(ring == NULL)
+        raler("newRing");
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->parked, 0);
+    ring->size = size;
+    ring->slotSize = slotSize;
+    ring->slots = malloc(slotSize * size);
+    if(ring->slots == NULL)
+        raler("newRing");
+
+    ring->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(ring->eventfd == -1)
+        raler("eventfd");
+    return ring;
+}
+
+void destroyRing(ring_t ring)
+{
+    close(ring->eventfd);
+    free(ring->slots);
+    free(ring);
+}
+
+int ringPush(ring_t ring, const void *data, size_t len)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if(tail - head == ring->size)
+        return -1;
+
+    memcpy(ring->slots + (tail & (ring->size - 1)) * ring->slotSize, data, MIN(len, ring->slotSize));
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    // the consumer checks the tail after parking, we check parked after the tail : one of us sees the other
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&ring->parked, memory_order_relaxed) && atomic_exchange(&ring->parked, 0))
+    {
+        uint64_t one = 1;
+        if(write(ring->eventfd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+            raler("write eventfd");
+    }
+    return 0;
+}
+
+int ringPop(ring_t ring, void *data)
+{
+    void *slot = ringFront(ring);
+    if(slot == NULL)
+        return -1;
+
+    memcpy(data, slot, ring->slotSize);
+    ringRelease(ring);
+    return 0;
+}
+
+void *ringFront(ring_t ring)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if(head == tail)
+        return NULL;
+
+    return ring->slots + (head & (ring->size - 1)) * ring->slotSize;
+}
+
+void ringRelease(ring_t ring)
+{
+    // the producer may overwrite the slot once it sees the new head
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int ringPark(ring_t ring)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    // park, then check again : a push done in between would not wake us up
+    atomic_store(&ring->parked, 1);
+    if(atomic_load(&ring->tail) != head)
+    {
+        atomic_store(&ring->parked, 0);
+        return 1;
+    }
+    return 0;
+}
+
+void ringUnpark(ring_t ring)
+{
+    atomic_store(&ring->parked, 0);
+
+    uint64_t count;
+    if(read(ring->eventfd, &count, sizeof(count)) != sizeof(count) && errno != EAGAIN)
+        raler("read eventfd");
+}
+
+#endif //_RING_H
@@ -0,0 +1,133 @@
+#ifndef _RTT_H
+#define _RTT_H
+
+#define RTT_INITIAL 50000 // RTO before the first measure, in microseconds
+#define RTT_MIN 5000 // lowest RTO, in microseconds
+#define RTT_MAX 4000000 // highest RTO, backoff included, in microseconds
+#define RTT_GRANULARITY 1000 // precision of the timers (tick of the timer wheel), in microseconds
+#define RTT_MAX_BACKOFF 8 // the RTO is doubled at most RTT_MAX_BACKOFF times in a row
+
+/** @struct rtt
+ *  @brief RTT estimation of a flux and the retransmission timeout (RTO) it gives (Jacobson/Karels, RFC 6298)
+ */
+/** @var rtt::srtt
+ *  Member 'srtt' contains the smoothed RTT, in microseconds
+ */
+/** @var rtt::rttvar
+ *  Member 'rttvar' contains the variation of the RTT, in microseconds
+ */
+/** @var rtt::latest
+ *  Member 'latest' contains the last RTT measured, in microseconds
+ */
+/** @var rtt::rto
+ *  Member 'rto' contains the retransmission timeout, backoff excluded, in microseconds
+ */
+/** @var rtt::backoff
+ *  Member 'backoff' contains the number of timeouts in a row, the RTO is doubled for each of them
+ */
+/** @var rtt::measured
+ *  Member 'measured' is set once the first measure has been made
+ */
+struct rtt
+{
+    uint32_t srtt;
+    uint32_t rttvar;
+    uint32_t latest;
+    uint32_t rto;
+    int backoff;
+    int measured;
+};
+
+/**
+ * @fn      void initRtt(struct rtt *rtt)
+ * @brief   Prepares the RTT estimation of a flux, RTT_INITIAL until the first measure
+ * @param   rtt     Estimation to prepare
+ */
+void initRtt(struct rtt *rtt);
+
+/**
+ * @fn      void rttSample(struct rtt *rtt, uint32_t sample)
+ * @brief   Updates the estimation with a new measure, the backoff is over
+ * @param   rtt     Estimation to update
+ * @param   sample  RTT measured, in microseconds
+ */
+void rttSample(struct rtt *rtt, uint32_t sample);
+
+/**
+ * @fn      void rttAck(struct rtt *rtt, packet_t packet)
+ * @brief   Measures the RTT with the echoHorodatage of an ACK acknowledging new data
+ * @param   rtt     Estimation of the flux
+ * @param   packet  ACK received
+ */
+void rttAck(struct rtt *rtt, packet_t packet);
+
+/**
+ * @fn      void rttBackoff(struct rtt *rtt)
+ * @brief   A timeout expired : the RTO is doubled until the next measure
+ * @param   rtt     Estimation of the flux
+ */
+void rttBackoff(struct rtt *rtt);
+
+/**
+ * @fn      uint64_t rttTimeout(struct rtt *rtt)
+ * @brief   Retransmission timeout to arm, backoff included
+ * @param   rtt     Estimation of the flux
+ * @return  The timeout, in microseconds
+ */
+uint64_t rttTimeout(struct rtt *rtt);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+void initRtt(struct rtt *rtt)
+{
+    rtt->srtt = 0;
+    rtt->rttvar = 0;
+    rtt->latest = 0;
+    rtt->rto = RTT_INITIAL;
+    rtt->backoff = 0;
+    rtt->measured = 0;
+}
+
+void rttSample(struct rtt *rtt, uint32_t sample)
+{
+    rtt->latest = sample;
+    if (!rtt->measured) // first measure
+    {
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
+        rtt->measured = 1;
+    }
+    else // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+    {
+        int64_t delta = (int64_t) sample - rtt->srtt;
+        rtt->rttvar = (uint32_t) ((int64_t) rtt->rttvar + ((delta < 0 ? -delta : delta) - (int64_t) rtt->rttvar) / 4);
+        rtt->srtt = (uint32_t) ((int64_t) rtt->srtt + delta / 8);
+    }
+
+    // RTO = SRTT + max(G, 4 RTTVAR)
+    uint64_t rto = (uint64_t) rtt->srtt + MAX(RTT_GRANULARITY, 4 * (uint64_t) rtt->rttvar);
+    rtt->rto = (uint32_t) MIN(MAX(rto, RTT_MIN), RTT_MAX);
+    rtt->backoff = 0;
+}
+
+void rttAck(struct rtt *rtt, packet_t packet)
+{
+    // the echo tells which copy of the packet is acknowledged : always a valid measure
+    if (packet->echoHorodatage != 0)
+        rttSample(rtt, timestampNow() - packet->echoHorodatage);
+}
+
+void rttBackoff(struct rtt *rtt)
+{
+    if (rtt->backoff < RTT_MAX_BACKOFF)
+        rtt->backoff++;
+}
+
+uint64_t rttTimeout(struct rtt *rtt)
+{
+    return MIN((uint64_t) rtt->rto << rtt->backoff, RTT_MAX);
+}
+
+#endif //_RTT_H
@@ -3,6 +3,13 @@
 
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <stdatomic.h>
+
+#include "uring.h" // io_uring backend of the send/receive helpers
 
 #define DEBUG 1
 #if defined(DEBUG) && DEBUG > 0
@@ -11,6 +18,50 @@
 #define DEBUG_PRINT(fmt, args...) /* Don't do anything in release builds */
 #endif
 
+#define PACKET_BATCH_SIZE 64 // max number of packets handled by a single batched system call
+#define SOCKET_BUFFER_SIZE (4 << 20) // receive buffer, thousands of fluxes can send at the same time
+#define SOCKET_GSO_SEGMENTS 64 // most packets the kernel cuts a single datagram into (UDP_MAX_SEGMENTS)
+_Static_assert(PACKET_BATCH_SIZE <= URING_ENTRIES, "a batch doesn't fit in an io_uring");
+
+int udpConnected = 0; // set by the user : a single socket for each endpoint, connected to the peer, it only receives from it
+atomic_int udpGso = 0; // the kernel cuts a burst of packets of the same size itself (UDP_SEGMENT), set by createTcp, cleared by any loop
+int udpGro = 0; // the kernel gives the packets received at once coalesced (UDP_GRO), set by prepareRecvSocket
+int udpTxtime = 0; // set by the user : each packet carries the time the kernel (fq) releases it (SO_TXTIME), cleared by createTcp if it can't
+
+/** @struct gro
+ *  @brief Datagrams received at once by a thread, the kernel may have coalesced several packets in each one (UDP_GRO)
+ *         They are cut into packets by recvPackets, the ones which don't fit wait here for the next call
+ */
+/** @var gro::data
+ *  Member 'data' contains PACKET_BATCH_SIZE datagrams of PACKET_MAX_SIZE bytes
+ */
+/** @var gro::len
+ *  Member 'len' contains the size of each datagram
+ */
+/** @var gro::segment
+ *  Member 'segment' contains the size of the packets of each datagram, the last one can be shorter
+ */
+/** @var gro::nb
+ *  Member 'nb' contains the number of datagrams
+ */
+/** @var gro::index
+ *  Member 'index' is the datagram the next packet is cut from
+ */
+/** @var gro::offset
+ *  Member 'offset' is the position of the next packet in this datagram
+ */
+struct gro
+{
+    char *data;
+    int len[PACKET_BATCH_SIZE];
+    int segment[PACKET_BATCH_SIZE];
+    int nb;
+    int index;
+    int offset;
+};
+
+__thread struct gro *groStage = NULL; // datagrams of the thread, created with its first packet
+
 /**
  * @fn      int createSocket()
  * @brief   Creates a socket
@@ -36,13 +87,34 @@ void closeSocket(int socket);
 struct sockaddr_in *prepareSendSocket(int socket, char *address, int port);
 
 /**
- * @fn      int prepareRecvSocket(int sock, int port)
- * @brief   Sets up a socket that will be used to receive packets
+ * @fn      int prepareRecvSocket(int sock, int port, int gro)
+ * @brief   Sets up a socket that will be used to receive packets, with a receive buffer big enough for many fluxes
  * @param   socket     Socket to prepare
  * @param   port       Port the socket will be linked to
+ * @param   gro        Boolean if the kernel may coalesce the packets received (UDP_GRO), false when a packet must
+ *                     reach the socket its idFlux picks (SO_REUSEPORT group)
  * @return  -1 if an error has occurred, else 0
  */
-int prepareRecvSocket(int socket, int port);
+int prepareRecvSocket(int socket, int port, int gro);
+
+/**
+ * @fn      int prepareShardedSockets(int *sockets, int nb, int port)
+ * @brief   Sets up nb sockets receiving on the same port (SO_REUSEPORT), the kernel gives each packet to sockets[idFlux % nb]
+ *          A classic BPF program reads idFlux at the beginning of the datagram (SO_ATTACH_REUSEPORT_CBPF)
+ * @param   sockets    Filled with the sockets, in the order the program picks them
+ * @param   nb         Number of sockets
+ * @param   port       Port the sockets will be linked to
+ * @return  -1 if an error has occurred (every socket closed), else 0
+ */
+int prepareShardedSockets(int *sockets, int nb, int port);
+
+/**
+ * @fn      int discoverMss(struct sockaddr_in *sockaddr)
+ * @brief   Finds the biggest data size a packet can carry on the way to an address without being fragmented
+ * @param   sockaddr    Address the packets will be sent to
+ * @return  Path MTU - IP and UDP headers - packet header, PACKET_DEFAULT_MSS if the MTU is unknown
+ */
+int discoverMss(struct sockaddr_in *sockaddr);
 
 /**
  * @fn      void sendPacket(int socket, packet_t packet, struct sockaddr_in *sockaddr)
@@ -56,30 +128,95 @@ int sendPacket(int socket, packet_t packet, struct sockaddr_in *sockaddr);
 
 /**
  * @fn      packet_t recvPacket(int socket, int size)
- * @brief   Receives a packet using a given socket
+ * @brief   Receives a packet using a given socket, malformed packets are dropped
  * @param   socket      Socket used to receive a packet
  * @param   size        Max size of the packet
  * @return  -1 if an error has occurred, else 0
  */
 int recvPacket(packet_t packet, int socket, int size);
 
+/**
+ * @fn      int sendPackets(int socket, packet_t *packets, int nb, struct sockaddr_in *sockaddr)
+ * @brief   Sends several packets using a given socket, with as few system calls as possible (sendmmsg)
+ * @param   socket      Socket used to send the packets
+ * @param   packets     Packets to be sent, in order
+ * @param   nb          Number of packets to be sent
+ * @param   sockaddr    Destination address
+ * @return  -1 if an error has occurred, else 0
+ */
+int sendPackets(int socket, packet_t *packets, int nb, struct sockaddr_in *sockaddr);
+
+/**
+ * @fn      int recvPackets(packet_t *packets, int socket, int nb, int size)
+ * @brief   Receives up to nb packets using a given socket in a single system call (recvmmsg)
+ *          Blocks until at least one packet is available, then only takes what is already queued
+ *          Malformed packets are dropped, the valid ones are moved to the front of packets
+ * @param   packets     Packets used to store what has been received
+ * @param   socket      Socket used to receive the packets
+ * @param   nb          Max number of packets to receive
+ * @param   size        Max size of each packet
+ * @return  Number of valid packets received, -1 if an error has occurred
+ */
+int recvPackets(packet_t *packets, int socket, int nb, int size);
+
+/**
+ * @fn      int recvFd(int socket, int size)
+ * @brief   File descriptor to poll before receiving from a socket : the socket, or the io_uring receiving from it
+ * @param   socket      Socket the packets are received from
+ * @param   size        Max size of each packet, the one given to recvPackets
+ * @return  The file descriptor, readable once recvPackets does not block
+ */
+int recvFd(int socket, int size);
+
+/**
+ * @fn      int recvPending()
+ * @brief   Tells if packets cut from a coalesced datagram are waiting : recvPackets does not block, no need to poll
+ * @return  1 if some are waiting, else 0
+ */
+int recvPending();
+
+/**
+ * @fn      void socketThreadExit()
+ * @brief   Frees what the calling thread used to send and receive packets (io_uring, coalesced datagrams)
+ */
+void socketThreadExit();
+
+/**
+ * @fn      int sendSegments(int socket, packet_t *headers, const char **data, const uint64_t *times, int nb, struct sockaddr_in *sockaddr)
+ * @brief   Sends several packets whose data is not stored in the packet itself (scatter-gather)
+ *          Each datagram is gathered by the kernel from its header and its data, nothing is copied before
+ *          Packets of the same size leaving at the same time go in a single datagram the kernel cuts again (UDP_SEGMENT) when it can
+ * @param   socket      Socket used to send the packets
+ * @param   headers     Header of each packet, tailleDonnees gives the size of its data
+ * @param   data        Data of each packet, usually pointing inside the buffer of a flux
+ * @param   times       Time the kernel releases each packet (SO_TXTIME, CLOCK_MONOTONIC, in nanoseconds), 0 : right away, NULL for all of them
+ * @param   nb          Number of packets to be sent
+ * @param   sockaddr    Destination address
+ * @return  -1 if an error has occurred, else 0
+ */
+int sendSegments(int socket, packet_t *headers, const char **data, const uint64_t *times, int nb, struct sockaddr_in *sockaddr);
+
 /** @struct tcp
  *  @brief This structure allows to communicate in a bidirectional way (TCP)
  */
 /** @var int::inSocket
- *  Member 'inSocket' contains the socket to receive messages
+ *  Member 'inSocket' contains the socket to receive messages, outSocket itself once connected
  */
 /** @var int::outSocket
- *  Member 'outSocket' contains the socket to send messages
+ *  Member 'outSocket' contains the socket to send messages, connected to "sockaddr" if the user asked for it
  */
 /** @var  struct sockaddr_in *::sockaddr
 *  Member 'sockaddr' contains the address used by "outSocket"
 */
+/** @var  int::mss
+*  Member 'mss' contains the biggest data size a packet can carry towards "sockaddr"
+*/
 struct tcp
 {
     int inSocket;
     int outSocket;
     struct sockaddr_in *sockaddr;
+    int mss;
 };
 typedef struct tcp *tcp_t;
 
@@ -131,7 +268,7 @@ struct sockaddr_in *prepareSendSocket(int socket, char *address, int port)
     return sockAddr;
 }
 
-int prepareRecvSocket(int socket, int port)
+int prepareRecvSocket(int socket, int port, int gro)
 {
     struct sockaddr_in socketAddr;
     memset(&socketAddr, 0, sizeof(socketAddr));
@@ -144,29 +281,417 @@ int prepareRecvSocket(int socket, int port)
     if (bind(socket, sockaddr, sizeof(socketAddr)) == -1)
         return -1;
 
+    // best effort : the kernel caps it to net.core.rmem_max
+    int size = SOCKET_BUFFER_SIZE;
+    setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    // best effort : packets of a burst coalesced, cut again by recvPackets
+    // not with io_uring, its multishot receive gives no control message : the size of the packets is unknown
+    int one = 1;
+    if (gro && !uringBackend && setsockopt(socket, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0)
+        udpGro = 1;
+
     return 0;
 }
 
+int discoverMss(struct sockaddr_in *sockaddr)
+{
+    int mtu;
+    socklen_t len = sizeof(mtu);
+    int sock = createSocket();
+    if (sock == -1)
+        return PACKET_DEFAULT_MSS;
+
+    // the kernel only knows the path MTU of a connected socket
+    if (connect(sock, (struct sockaddr *) sockaddr, sizeof(*sockaddr)) == -1
+        || getsockopt(sock, IPPROTO_IP, IP_MTU, &mtu, &len) == -1)
+    {
+        closeSocket(sock);
+        return PACKET_DEFAULT_MSS;
+    }
+    closeSocket(sock);
+
+    int mss = mtu - 20 - 8 - PACKET_HEADER_SIZE; // IP header, UDP header, packet header
+    if (mss < PACKET_DEFAULT_MSS)
+        return PACKET_DEFAULT_MSS;
+    return MIN(mss, PACKET_MAX_DATA_SIZE);
+}
+
 int sendPacket(int socket, packet_t packet, struct sockaddr_in *sockaddr)
 {
+    if (uringBackend) // a batch of one packet
+        return sendPackets(socket, &packet, 1, sockaddr);
+
+    if (udpConnected) // the kernel already knows where to, and its route
+        return send(socket, packet, packetSize(packet), 0) == -1 && errno != ECONNREFUSED ? -1 : 0;
+
     struct sockaddr *sp = (struct sockaddr *) &(*sockaddr);
     //DEBUG_PRINT("SendTo: Flux thread=%d, go packet, ack=%d, seqNum:%d, type=%s \n", packet->idFlux, packet->numAcquittement, packet->numSequence, packet->type | ACK ? "ACK" : "Other");
-    return sendto(socket, packet, 52, 0, sp, sizeof(*sp)) == -1 ? -1 : 0;
+    return sendto(socket, packet, packetSize(packet), 0, sp, sizeof(*sp)) == -1 ? -1 : 0;
 }
 
 int recvPacket(packet_t packet, int socket, int size)
 {
+    if (uringBackend || udpGro) // a batch of one packet, until a valid one arrives
+    {
+        int r;
+        while ((r = recvPackets(&packet, socket, 1, size)) == 0);
+        return r == -1 ? -1 : 0;
+    }
+
     struct sockaddr from;
     socklen_t addrlen = sizeof(from);
 
-    if (recvfrom(socket, packet, size, 0, &from, &addrlen) == -1)
-        return -1;
+    ssize_t len;
+    do
+    {
+        len = recvfrom(socket, packet, size, 0, &from, &addrlen);
+        if (len == -1 && errno != ECONNREFUSED) // connected : the peer was not there yet, nothing received
+            return -1;
+    } while (len == -1 || decodePacket(packet, len) == -1);
 
     //DEBUG_PRINT("RevcPacket: Flux thread=%d, go packet, ack=%d, seqNum:%d, type=%s \n", packet->idFlux, packet->numAcquittement, packet->numSequence, packet->type & ACK ? "ACK" : "Other");
 
     return 0;
 }
 
+/**
+ * @fn      int sendMessages(int socket, struct mmsghdr *msgs, int nb)
+ * @brief   Sends datagrams in a single system call, with io_uring if the user asked for it, else sendmmsg
+ * @param   socket      Socket used to send them
+ * @param   msgs        Datagrams, at most PACKET_BATCH_SIZE
+ * @param   nb          Number of datagrams
+ * @return  Number of datagrams sent (the first ones), -1 if an error has occurred
+ */
+int sendMessages(int socket, struct mmsghdr *msgs, int nb)
+{
+    uring_t ring = uringBackend ? uringThreadSend() : NULL;
+    int r = ring != NULL ? uringSend(ring, socket, msgs, nb) : sendmmsg(socket, msgs, nb, 0);
+
+    // connected : the peer was not there when an earlier datagram arrived (ICMP)
+    // the kernel reports it instead of sending the first one, lost like the network would
+    if (r == -1 && errno == ECONNREFUSED)
+        return 1;
+    return r;
+}
+
+int sendPackets(int socket, packet_t *packets, int nb, struct sockaddr_in *sockaddr)
+{
+    struct mmsghdr msgs[PACKET_BATCH_SIZE];
+    struct iovec iovecs[PACKET_BATCH_SIZE];
+    int sent = 0;
+
+    while (sent < nb)
+    {
+        int len = MIN(nb - sent, PACKET_BATCH_SIZE);
+
+        memset(msgs, 0, sizeof(struct mmsghdr) * len);
+        for (int i = 0; i < len; ++i)
+        {
+            iovecs[i].iov_base = packets[sent + i];
+            iovecs[i].iov_len = packetSize(packets[sent + i]);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (!udpConnected) // else the kernel already knows where to
+            {
+                msgs[i].msg_hdr.msg_name = sockaddr;
+                msgs[i].msg_hdr.msg_namelen = sizeof(*sockaddr);
+            }
+        }
+
+        // the kernel may send less than asked, keep going from where it stopped
+        int r = sendMessages(socket, msgs, len);
+        if (r == -1)
+            return -1;
+        sent += r;
+    }
+
+    return 0;
+}
+
+/**
+ * @fn      int recvCoalesced(packet_t *packets, int socket, int nb, int size)
+ * @brief   recvPackets on a socket receiving coalesced packets (UDP_GRO) : the datagrams are received in the stage of the thread
+ *          and cut into packets there, the kernel tells their size, the ones which don't fit wait for the next call
+ * @param   packets     Packets used to store what has been received
+ * @param   socket      Socket used to receive the packets
+ * @param   nb          Max number of packets to receive
+ * @param   size        Max size of each packet
+ * @return  Number of valid packets received, -1 if an error has occurred
+ */
+int recvCoalesced(packet_t *packets, int socket, int nb, int size)
+{
+    struct gro *gro = groStage;
+    if (gro == NULL)
+    {
+        gro = malloc(sizeof(struct gro));
+        if (gro == NULL || (gro->data = malloc((size_t) PACKET_BATCH_SIZE * PACKET_MAX_SIZE)) == NULL)
+            raler("recvCoalesced");
+        gro->nb = gro->index = gro->offset = 0;
+        groStage = gro;
+    }
+
+    if (gro->index == gro->nb) // everything has been given : receive again
+    {
+        struct mmsghdr msgs[PACKET_BATCH_SIZE];
+        struct iovec iovecs[PACKET_BATCH_SIZE];
+        union { char buf[CMSG_SPACE(sizeof(int))]; struct cmsghdr align; } controls[PACKET_BATCH_SIZE];
+
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < PACKET_BATCH_SIZE; ++i)
+        {
+            iovecs[i].iov_base = gro->data + (size_t) i * PACKET_MAX_SIZE;
+            iovecs[i].iov_len = PACKET_MAX_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls[i].buf;
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+        }
+
+        // MSG_WAITFORONE : blocks for the first packet only, then takes what is already queued
+        int r = recvmmsg(socket, msgs, PACKET_BATCH_SIZE, MSG_WAITFORONE, NULL);
+        if (r == -1)
+            return errno == ECONNREFUSED ? 0 : -1; // connected : the peer was not there yet, nothing received
+
+        for (int i = 0; i < r; ++i)
+        {
+            // a single packet, unless the kernel tells the size of the ones it coalesced
+            gro->len[i] = (int) msgs[i].msg_len;
+            gro->segment[i] = (int) msgs[i].msg_len;
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+            {
+                int segment;
+                if (cmsg->cmsg_level != SOL_UDP || cmsg->cmsg_type != UDP_GRO)
+                    continue;
+                memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+                if (segment > 0)
+                    gro->segment[i] = segment;
+            }
+        }
+        gro->nb = r;
+        gro->index = gro->offset = 0;
+    }
+
+    // cuts the packets in order, the valid ones at the front
+    int valid = 0;
+    while (valid < nb && gro->index < gro->nb)
+    {
+        int index = gro->index;
+        int len = MIN(gro->segment[index], gro->len[index] - gro->offset);
+        memcpy(packets[valid], gro->data + (size_t) index * PACKET_MAX_SIZE + gro->offset, MIN(len, size));
+        if (decodePacket(packets[valid], MIN(len, size)) == 0)
+            valid++;
+
+        gro->offset += len;
+        if (gro->offset >= gro->len[index])
+        {
+            gro->index++;
+            gro->offset = 0;
+        }
+    }
+
+    return valid;
+}
+
+int recvPackets(packet_t *packets, int socket, int nb, int size)
+{
+    // the kernel already received them in our buffers (multishot), no system call unless there is none
+    uring_t ring = uringBackend ? uringThreadRecv(socket, size) : NULL;
+    if (ring != NULL)
+        return uringRecv(ring, packets, MIN(nb, PACKET_BATCH_SIZE));
+    if (udpGro)
+        return recvCoalesced(packets, socket, nb, size);
+
+    struct mmsghdr msgs[PACKET_BATCH_SIZE];
+    struct iovec iovecs[PACKET_BATCH_SIZE];
+    int len = MIN(nb, PACKET_BATCH_SIZE);
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * len);
+    for (int i = 0; i < len; ++i)
+    {
+        iovecs[i].iov_base = packets[i];
+        iovecs[i].iov_len = size;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // MSG_WAITFORONE : blocks for the first packet only, then takes what is already queued
+    int r = recvmmsg(socket, msgs, len, MSG_WAITFORONE, NULL);
+    if (r == -1)
+        return errno == ECONNREFUSED ? 0 : -1; // connected : the peer was not there yet, nothing received
+
+    // keeps the valid packets at the front, swapping buffers so none is lost
+    int valid = 0;
+    for (int i = 0; i < r; ++i)
+    {
+        if (decodePacket(packets[i], msgs[i].msg_len) == -1)
+            continue;
+        packet_t tmp = packets[valid];
+        packets[valid++] = packets[i];
+        packets[i] = tmp;
+    }
+
+    return valid;
+}
+
+int recvFd(int socket, int size)
+{
+    uring_t ring = uringBackend ? uringThreadRecv(socket, size) : NULL;
+    return ring != NULL ? ring->fd : socket;
+}
+
+int recvPending()
+{
+    return groStage != NULL && groStage->index < groStage->nb;
+}
+
+void socketThreadExit()
+{
+    uringThreadExit();
+    if (groStage != NULL)
+    {
+        free(groStage->data);
+        free(groStage);
+        groStage = NULL;
+    }
+}
+
+int sendSegments(int socket, packet_t *headers, const char **data, const uint64_t *times, int nb, struct sockaddr_in *sockaddr)
+{
+    struct mmsghdr msgs[PACKET_BATCH_SIZE];
+    struct iovec iovecs[2 * PACKET_BATCH_SIZE];
+    union { char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t))]; struct cmsghdr align; } controls[PACKET_BATCH_SIZE];
+    int counts[PACKET_BATCH_SIZE]; // packets in each datagram
+    int sent = 0;
+
+    while (sent < nb)
+    {
+        int gso = atomic_load_explicit(&udpGso, memory_order_relaxed); // another loop may clear it meanwhile
+        int len = MIN(nb - sent, PACKET_BATCH_SIZE);
+        int nb_msgs = 0;
+
+        memset(msgs, 0, sizeof(struct mmsghdr) * len);
+        for (int i = 0; i < len; i += counts[nb_msgs++])
+        {
+            // packets of the same size (only the last one can be shorter) in a single datagram, the kernel cuts it again
+            int size = PACKET_HEADER_SIZE + headers[sent + i]->tailleDonnees, count = 0, total = 0;
+            uint64_t txtime = udpTxtime && times != NULL ? times[sent + i] : 0; // the whole datagram leaves at once
+            do
+            {
+                // header, then data : one packet
+                packet_t header = headers[sent + i + count];
+                iovecs[2 * (i + count)].iov_base = header;
+                iovecs[2 * (i + count)].iov_len = PACKET_HEADER_SIZE;
+                iovecs[2 * (i + count) + 1].iov_base = (void *) data[sent + i + count];
+                iovecs[2 * (i + count) + 1].iov_len = header->tailleDonnees;
+                total += PACKET_HEADER_SIZE + header->tailleDonnees;
+                count++;
+            } while (gso && i + count < len && count < SOCKET_GSO_SEGMENTS
+                     && (txtime == 0 || times[sent + i + count] == txtime)
+                     && PACKET_HEADER_SIZE + headers[sent + i + count - 1]->tailleDonnees == size
+                     && PACKET_HEADER_SIZE + headers[sent + i + count]->tailleDonnees <= size
+                     && total + PACKET_HEADER_SIZE + headers[sent + i + count]->tailleDonnees <= PACKET_MAX_SIZE);
+
+            struct msghdr *msg = &msgs[nb_msgs].msg_hdr;
+            msg->msg_iov = &iovecs[2 * i];
+            msg->msg_iovlen = 2 * count;
+            if (!udpConnected) // else the kernel already knows where to
+            {
+                msg->msg_name = sockaddr;
+                msg->msg_namelen = sizeof(*sockaddr);
+            }
+            size_t controllen = 0;
+            if (count > 1) // the size of the packets the kernel cuts the datagram into
+            {
+                uint16_t segment = (uint16_t) size;
+                struct cmsghdr *cmsg = (struct cmsghdr *) controls[nb_msgs].buf;
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+                memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+                controllen += CMSG_SPACE(sizeof(segment));
+            }
+            if (txtime != 0) // the qdisc (fq) holds it until then
+            {
+                struct cmsghdr *cmsg = (struct cmsghdr *) (controls[nb_msgs].buf + controllen);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_TXTIME;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(txtime));
+                memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+                controllen += CMSG_SPACE(sizeof(txtime));
+            }
+            if (controllen > 0)
+            {
+                msg->msg_control = controls[nb_msgs].buf;
+                msg->msg_controllen = controllen;
+            }
+            counts[nb_msgs] = count;
+        }
+
+        // the kernel may send less than asked, keep going from where it stopped
+        int r = sendMessages(socket, msgs, nb_msgs);
+        if (r == -1 && gso && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOPROTOOPT))
+        {
+            // the kernel can't cut them on the way (no checksum offload...) : a datagram for each packet from now on
+            atomic_store_explicit(&udpGso, 0, memory_order_relaxed);
+            continue;
+        }
+        if (r == -1)
+            return -1;
+        for (int i = 0; i < r; ++i)
+            sent += counts[i];
+    }
+
+    return 0;
+}
+
+int prepareShardedSockets(int *sockets, int nb, int port)
+{
+    // idFlux is the first field of a packet, in host byte order : loaded a byte at a time (ld h swaps them)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint32_t high = 1, low = 0;
+#else
+    const uint32_t high = 0, low = 1;
+#endif
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, high),           // A = high byte of idFlux
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),             // A <<= 8
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),                    // X = A
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, low),            // A = low byte of idFlux
+        BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),              // A |= X : idFlux
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t) nb), // A %= nb
+        BPF_STMT(BPF_RET | BPF_A, 0),                       // index of the socket
+    };
+    struct sock_fprog program = { sizeof(code) / sizeof(code[0]), code };
+
+    // every socket of the group has SO_REUSEPORT before being bound, the index of a socket is its bind order
+    int one = 1;
+    for (int i = 0; i < nb; ++i)
+    {
+        sockets[i] = createSocket();
+        if (sockets[i] == -1
+            || setsockopt(sockets[i], SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1
+            || prepareRecvSocket(sockets[i], port, 0) == -1) // coalesced, the fluxes after the first would follow it
+        {
+            for (int j = 0; j < i; ++j)
+                closeSocket(sockets[j]);
+            if (sockets[i] != -1)
+                closeSocket(sockets[i]);
+            return -1;
+        }
+    }
+
+    // the program is shared by the whole group
+    if (setsockopt(sockets[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1)
+    {
+        for (int i = 0; i < nb; ++i)
+            closeSocket(sockets[i]);
+        return -1;
+    }
+
+    return 0;
+}
+
 tcp_t createTcp(char *ip, int port_local, int port_medium)
 {
     // alloc TCP general structure
@@ -181,6 +706,32 @@ tcp_t createTcp(char *ip, int port_local, int port_medium)
     // TCP adresses
     struct sockaddr_in *sockAddr = prepareSendSocket(tcp->outSocket, ip, port_medium);
     tcp->sockaddr = sockAddr;
+    tcp->mss = discoverMss(sockAddr);
+
+    // the kernel cuts our bursts itself if it knows how to (UDP_SEGMENT), else a datagram for each packet
+    int segment;
+    socklen_t segmentLen = sizeof(segment);
+    udpGso = getsockopt(tcp->outSocket, SOL_UDP, UDP_SEGMENT, &segment, &segmentLen) == 0;
+
+    // the packets can carry the time they leave at, the kernel paces them if the interface has a qdisc that reads it (fq)
+    if(udpTxtime)
+    {
+        struct sock_txtime txtime = { CLOCK_MONOTONIC, 0 };
+        udpTxtime = setsockopt(tcp->outSocket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0;
+    }
+
+    // connected : the same socket receives, from the peer only
+    if(udpConnected)
+    {
+        tcp->inSocket = tcp->outSocket;
+        if(prepareRecvSocket(tcp->inSocket, port_local, 1) == -1
+           || connect(tcp->outSocket, (struct sockaddr *) sockAddr, sizeof(*sockAddr)) == -1)
+        {
+            closeSocket(tcp->outSocket);
+            raler("connect");
+        }
+        return tcp;
+    }
 
     // TCP reading socket
     tcp->inSocket = createSocket();
@@ -189,7 +740,7 @@ tcp_t createTcp(char *ip, int port_local, int port_medium)
         closeSocket(tcp->inSocket);
         raler("create inSocket");
     }
-    if(prepareRecvSocket(tcp->inSocket, port_local) == -1)
+    if(prepareRecvSocket(tcp->inSocket, port_local, 1) == -1)
     {
         closeSocket(tcp->outSocket);
         closeSocket(tcp->inSocket);
@@ -202,7 +753,8 @@ tcp_t createTcp(char *ip, int port_local, int port_medium)
 void destroyTcp(tcp_t tcp)
 {
     closeSocket(tcp->outSocket);
-    closeSocket(tcp->inSocket);
+    if(tcp->inSocket != tcp->outSocket)
+        closeSocket(tcp->inSocket);
     free(tcp);
 }
 
@@ -0,0 +1,345 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <sys/timerfd.h>
+
+#define TIMER_TICK 1000 // duration of a tick, in microseconds
+#define TIMER_LEVEL_BITS 6
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS) // slots of each level
+#define TIMER_LEVELS 4 // a level covers TIMER_SLOTS times the span of the level below : 4 levels ~ 4h40
+#define TIMER_MAX_TICKS (((uint64_t) 1 << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+/** @struct timer
+ *  @brief A timer, meant to be embedded in the structure it belongs to (a flux)
+ */
+/** @var timer::next
+ *  Member 'next' is the next timer of the same slot
+ */
+/** @var timer::prev
+ *  Member 'prev' is the previous timer of the same slot, NULL while the timer is not armed
+ */
+/** @var timer::expires
+ *  Member 'expires' contains the tick the timer expires at
+ */
+/** @var timer::slot
+ *  Member 'slot' contains the slot the timer is in, level * TIMER_SLOTS + slot of the level
+ */
+/** @var timer::data
+ *  Member 'data' contains whatever the owner needs once the timer expired
+ */
+struct timer
+{
+    struct timer *next;
+    struct timer *prev;
+    uint64_t expires;
+    int slot;
+    void *data;
+};
+
+/** @struct wheel
+ *  @brief Hierarchical timer wheel : arming, cancelling and expiring a timer is O(1) whatever the number of timers
+ *         Level 0 has one slot per tick, the timers of the upper levels move down (cascade) as their time comes
+ */
+/** @var wheel::slots
+ *  Member 'slots' contains the list of timers of each slot, a slot is its own list head
+ */
+/** @var wheel::used
+ *  Member 'used' has one bit for each slot of a level holding timers
+ */
+/** @var wheel::tick
+ *  Member 'tick' contains the last tick whose timers have expired
+ */
+/** @var wheel::start
+ *  Member 'start' contains the time of the tick 0 (monotonicTime)
+ */
+/** @var wheel::armed
+ *  Member 'armed' contains the tick timerfd expires at, 0 if it is not armed
+ */
+/** @var wheel::timerfd
+ *  Member 'timerfd' becomes readable when the next timer expires (CLOCK_MONOTONIC)
+ */
+struct wheel
+{
+    struct timer slots[TIMER_LEVELS][TIMER_SLOTS];
+    uint64_t used[TIMER_LEVELS];
+    uint64_t tick;
+    uint64_t start;
+    uint64_t armed;
+    int timerfd;
+};
+typedef struct wheel *wheel_t;
+
+/**
+ * @fn      wheel_t newWheel()
+ * @brief   Allocates an empty timer wheel and its timerfd
+ * @return  Wheel created
+ */
+wheel_t newWheel();
+
+/**
+ * @fn      void destroyWheel(wheel_t wheel)
+ * @brief   Destroys a wheel, frees structure and closes its timerfd, the timers are not touched
+ * @param   wheel   Wheel to destroy
+ */
+void destroyWheel(wheel_t wheel);
+
+/**
+ * @fn      void initTimer(struct timer *timer, void *data)
+ * @brief   Prepares a timer before its first use
+ * @param   timer   Timer to prepare
+ * @param   data    Given back once the timer expired
+ */
+void initTimer(struct timer *timer, void *data);
+
+/**
+ * @fn      int timerArmed(struct timer *timer)
+ * @brief   Checks if a timer is in a wheel
+ * @param   timer   Timer to check
+ * @return  1 if it is armed, else 0
+ */
+int timerArmed(struct timer *timer);
+
+/**
+ * @fn      void wheelArm(wheel_t wheel, struct timer *timer, uint64_t expires)
+ * @brief   Arms a timer, it is moved if it is already armed
+ * @param   wheel   Wheel the timer goes in
+ * @param   timer   Timer to arm
+ * @param   expires Time it expires at (monotonicTime), rounded up to the next tick
+ */
+void wheelArm(wheel_t wheel, struct timer *timer, uint64_t expires);
+
+/**
+ * @fn      void wheelCancel(wheel_t wheel, struct timer *timer)
+ * @brief   Cancels a timer, nothing happens if it is not armed
+ * @param   wheel   Wheel the timer is in
+ * @param   timer   Timer to cancel
+ */
+void wheelCancel(wheel_t wheel, struct timer *timer);
+
+/**
+ * @fn      struct timer *wheelExpire(wheel_t wheel, uint64_t now)
+ * @brief   Moves the wheel forward up to now, and takes out every timer that expired on the way
+ * @param   wheel   Wheel to move
+ * @param   now     Current time (monotonicTime)
+ * @return  List of the timers that expired (linked by next), NULL if none
+ */
+struct timer *wheelExpire(wheel_t wheel, uint64_t now);
+
+/**
+ * @fn      void wheelSchedule(wheel_t wheel)
+ * @brief   Arms timerfd for the next tick holding timers, only a system call if it changed
+ * @param   wheel   Wheel to schedule
+ */
+void wheelSchedule(wheel_t wheel);
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+wheel_t newWheel()
+{
+    wheel_t wheel = malloc(sizeof(struct wheel));
+    if(wheel == NULL)
+        raler("newWheel");
+
+    for(int level = 0; level < TIMER_LEVELS; ++level)
+    {
+        for(int slot = 0; slot < TIMER_SLOTS; ++slot)
+        {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
+        wheel->used[level] = 0;
+    }
+
+    wheel->start = monotonicTime();
+    wheel->tick = 0;
+    wheel->armed = 0;
+    wheel->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(wheel->timerfd == -1)
+        raler("timerfd_create");
+    return wheel;
+}
+
+void destroyWheel(wheel_t wheel)
+{
+    close(wheel->timerfd);
+    free(wheel);
+}
+
+void initTimer(struct timer *timer, void *data)
+{
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->slot = 0;
+    timer->data = data;
+}
+
+int timerArmed(struct timer *timer)
+{
+    return timer->prev != NULL;
+}
+
+void wheelCancel(wheel_t wheel, struct timer *timer)
+{
+    if(timer->prev == NULL)
+        return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+
+    // the slot is empty once its list only holds its head
+    int level = timer->slot / TIMER_SLOTS, slot = timer->slot % TIMER_SLOTS;
+    if(wheel->slots[level][slot].next == &wheel->slots[level][slot])
+        wheel->used[level] &= ~((uint64_t) 1 << slot);
+
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+/**
+ * @fn      void wheelInsert(wheel_t wheel, struct timer *timer)
+ * @brief   Puts a timer in the slot of its expiry tick, the level depends on how far it is from the current tick
+ *          A timer expiring at the current tick goes in the slot of level 0 about to be taken (cascade)
+ * @param   wheel   Wheel the timer goes in
+ * @param   timer   Timer to insert, not armed
+ */
+void wheelInsert(wheel_t wheel, struct timer *timer)
+{
+    if(timer->expires < wheel->tick)
+        timer->expires = wheel->tick;
+    if(timer->expires - wheel->tick > TIMER_MAX_TICKS)
+        timer->expires = wheel->tick + TIMER_MAX_TICKS;
+
+    uint64_t delta = timer->expires - wheel->tick;
+    int level = 0;
+    while(level < TIMER_LEVELS - 1 && delta >= ((uint64_t) 1 << (TIMER_LEVEL_BITS * (level + 1))))
+        level++;
+    int slot = (timer->expires >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1);
+
+    struct timer *head = &wheel->slots[level][slot];
+    timer->slot = level * TIMER_SLOTS + slot;
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    wheel->used[level] |= (uint64_t) 1 << slot;
+}
+
+void wheelArm(wheel_t wheel, struct timer *timer, uint64_t expires)
+{
+    wheelCancel(wheel, timer);
+    timer->expires = expires <= wheel->start ? 0 : (expires - wheel->start + TIMER_TICK - 1) / TIMER_TICK;
+    if(timer->expires <= wheel->tick) // the current tick is over : expires with the next one
+        timer->expires = wheel->tick + 1;
+    wheelInsert(wheel, timer);
+}
+
+/**
+ * @fn      struct timer *wheelTake(wheel_t wheel, int level, int slot)
+ * @brief   Empties a slot
+ * @param   wheel   Wheel to take from
+ * @param   level   Level of the slot
+ * @param   slot    Slot to empty
+ * @return  The timers of the slot (linked by next), NULL if none
+ */
+struct timer *wheelTake(wheel_t wheel, int level, int slot)
+{
+    struct timer *head = &wheel->slots[level][slot];
+    if(head->next == head)
+        return NULL;
+
+    struct timer *first = head->next;
+    head->prev->next = NULL;
+    head->next = head;
+    head->prev = head;
+    wheel->used[level] &= ~((uint64_t) 1 << slot);
+    return first;
+}
+
+struct timer *wheelExpire(wheel_t wheel, uint64_t now)
+{
+    uint64_t target = now <= wheel->start ? 0 : (now - wheel->start) / TIMER_TICK;
+    struct timer *expired = NULL;
+
+    while(wheel->tick < target)
+    {
+        int empty = 1;
+        for(int level = 0; level < TIMER_LEVELS; ++level)
+            empty &= wheel->used[level] == 0;
+        if(empty) // nothing to expire on the way
+        {
+            wheel->tick = target;
+            break;
+        }
+
+        wheel->tick++;
+
+        // the timers of an upper slot move down once the levels below wrap around
+        for(int level = 1; level < TIMER_LEVELS; ++level)
+        {
+            if((wheel->tick & (((uint64_t) 1 << (TIMER_LEVEL_BITS * level)) - 1)) != 0)
+                break;
+            struct timer *timer = wheelTake(wheel, level, (wheel->tick >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1));
+            while(timer != NULL)
+            {
+                struct timer *next = timer->next;
+                wheelInsert(wheel, timer);
+                timer = next;
+            }
+        }
+
+        struct timer *timer = wheelTake(wheel, 0, wheel->tick & (TIMER_SLOTS - 1));
+        while(timer != NULL)
+        {
+            struct timer *next = timer->next;
+            timer->prev = NULL; // not armed anymore
+            timer->next = expired;
+            expired = timer;
+            timer = next;
+        }
+    }
+
+    return expired;
+}
+
+void wheelSchedule(wheel_t wheel)
+{
+    uint64_t next = 0; // 0 : nothing to wait for
+
+    // next slot of level 0 holding timers, after the current tick
+    int shift = (wheel->tick + 1) & (TIMER_SLOTS - 1);
+    uint64_t rotated = shift == 0 ? wheel->used[0] : (wheel->used[0] >> shift) | (wheel->used[0] << (TIMER_SLOTS - shift));
+    if(rotated != 0)
+        next = wheel->tick + 1 + __builtin_ctzll(rotated);
+
+    // the upper levels only move down when level 0 wraps around
+    for(int level = 1; level < TIMER_LEVELS; ++level)
+    {
+        if(wheel->used[level] == 0)
+            continue;
+        uint64_t wrap = (wheel->tick | (TIMER_SLOTS - 1)) + 1;
+        if(next == 0 || wrap < next)
+            next = wrap;
+        break;
+    }
+
+    if(next == wheel->armed)
+        return;
+    wheel->armed = next;
+
+    // absolute time, a zero it_value disarms timerfd
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if(next != 0)
+    {
+        uint64_t time = wheel->start + next * TIMER_TICK;
+        spec.it_value.tv_sec = time / 1000000;
+        spec.it_value.tv_nsec = (time % 1000000) * 1000;
+    }
+    if(timerfd_settime(wheel->timerfd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+        raler("timerfd_settime");
+}
+
+#endif //_TIMER_H
@@ -0,0 +1,549 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+#define URING_ENTRIES 64 // submissions of a ring, power of 2 : a batch of packets at once
+#define URING_BUFFERS 64 // buffers the kernel receives into, power of 2
+#define URING_TAG_RECV 1 // user_data of the multishot receive
+#define URING_TAG_CANCEL 2 // user_data of its cancellation
+
+/** @struct uring
+ *  @brief io_uring of a thread (raw system calls), to send packets or to receive them from a socket
+ *         The submission and completion queues are shared with the kernel, a system call only waits or submits
+ */
+/** @var uring::fd
+ *  Member 'fd' is the io_uring, it can be polled : readable once a completion is waiting
+ */
+/** @var uring::sqHead
+ *  Member 'sqHead' is the next submission the kernel reads, only written by the kernel
+ */
+/** @var uring::sqTail
+ *  Member 'sqTail' is the next submission we write
+ */
+/** @var uring::sqMask
+ *  Member 'sqMask' is the number of submissions - 1
+ */
+/** @var uring::sqArray
+ *  Member 'sqArray' contains the index of each submission in sqes
+ */
+/** @var uring::sqes
+ *  Member 'sqes' contains the submissions
+ */
+/** @var uring::cqHead
+ *  Member 'cqHead' is the next completion we read
+ */
+/** @var uring::cqTail
+ *  Member 'cqTail' is the next completion the kernel writes, only written by the kernel
+ */
+/** @var uring::cqMask
+ *  Member 'cqMask' is the number of completions - 1
+ */
+/** @var uring::cqes
+ *  Member 'cqes' contains the completions
+ */
+/** @var uring::sq
+ *  Member 'sq' is the memory of the submission queue, the completion queue shares it (IORING_FEAT_SINGLE_MMAP)
+ */
+/** @var uring::sqLen
+ *  Member 'sqLen' contains the size of sq
+ */
+/** @var uring::cq
+ *  Member 'cq' is the memory of the completion queue
+ */
+/** @var uring::cqLen
+ *  Member 'cqLen' contains the size of cq
+ */
+/** @var uring::sqesLen
+ *  Member 'sqesLen' contains the size of sqes
+ */
+/** @var uring::socket
+ *  Member 'socket' is the socket received from, -1 for a ring sending packets
+ */
+/** @var uring::armed
+ *  Member 'armed' is set while the multishot receive runs, the kernel stops it when it runs out of buffers
+ */
+/** @var uring::buffers
+ *  Member 'buffers' is the ring of buffers given to the kernel (provided buffers), a buffer comes back once read
+ */
+/** @var uring::bufferTail
+ *  Member 'bufferTail' is the next entry of buffers we write
+ */
+/** @var uring::bufferData
+ *  Member 'bufferData' contains URING_BUFFERS buffers of bufferSize bytes, a datagram in each
+ */
+/** @var uring::bufferSize
+ *  Member 'bufferSize' contains the size of a buffer, the biggest datagram received
+ */
+struct uring
+{
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    void *sq;
+    size_t sqLen;
+    void *cq;
+    size_t cqLen;
+    size_t sqesLen;
+    int socket;
+    int armed;
+    struct io_uring_buf_ring *buffers;
+    unsigned short bufferTail;
+    char *bufferData;
+    int bufferSize;
+};
+typedef struct uring *uring_t;
+
+int uringBackend = 0; // set by the user : packets go through io_uring instead of sendmmsg and recvmmsg
+__thread uring_t uringSendRing = NULL; // ring of the thread to send, created with its first packet
+__thread uring_t uringRecvRing = NULL; // ring of the thread to receive, created with its first packet
+__thread int uringTried = 0; // 1 once the thread created its ring to send, 2 to receive : no io_uring if it is still NULL
+
+/**
+ * @fn      uring_t newUring(unsigned entries)
+ * @brief   Creates an io_uring and maps its queues
+ * @param   entries     Number of submissions, power of 2
+ * @return  Ring created, NULL if io_uring is not available (old kernel, forbidden by seccomp)
+ */
+uring_t newUring(unsigned entries);
+
+/**
+ * @fn      void destroyUring(uring_t ring)
+ * @brief   Stops the multishot receive, unmaps the queues and closes the io_uring
+ * @param   ring    Ring to destroy, can be NULL
+ */
+void destroyUring(uring_t ring);
+
+/**
+ * @fn      int uringSend(uring_t ring, int socket, struct mmsghdr *msgs, int nb)
+ * @brief   Sends datagrams with linked submissions (in order), submitted and waited for in a single system call
+ * @param   ring        Ring of the thread to send
+ * @param   socket      Socket used to send them
+ * @param   msgs        Datagrams, at most URING_ENTRIES
+ * @param   nb          Number of datagrams
+ * @return  Number of datagrams sent, they are the first ones (like sendmmsg), -1 if none was (errno set)
+ */
+int uringSend(uring_t ring, int socket, struct mmsghdr *msgs, int nb);
+
+/**
+ * @fn      int uringArm(uring_t ring, int socket, int size)
+ * @brief   Gives the kernel buffers of size bytes and starts receiving from a socket into them (multishot receive)
+ * @param   ring        Ring of the thread to receive
+ * @param   socket      Socket received from, from now on only through this ring
+ * @param   size        Max size of a datagram
+ * @return  -1 if an error has occurred, else 0
+ */
+int uringArm(uring_t ring, int socket, int size);
+
+/**
+ * @fn      int uringRecv(uring_t ring, packet_t *packets, int nb)
+ * @brief   Takes up to nb datagrams the kernel already received, waits for the first one only
+ *          Malformed packets are dropped, the valid ones are copied at the front of packets
+ * @param   ring        Ring armed by uringArm
+ * @param   packets     Packets used to store what has been received, bufferSize bytes each
+ * @param   nb          Max number of packets to receive
+ * @return  Number of valid packets received, -1 if an error has occurred (errno set)
+ */
+int uringRecv(uring_t ring, packet_t *packets, int nb);
+
+/**
+ * @fn      uring_t uringThreadSend()
+ * @brief   Ring of the calling thread to send, created the first time
+ * @return  The ring, NULL if io_uring is not available
+ */
+uring_t uringThreadSend();
+
+/**
+ * @fn      uring_t uringThreadRecv(int socket, int size)
+ * @brief   Ring of the calling thread receiving from a socket, created and armed the first time
+ * @param   socket      Socket received from, a thread only receives from one socket through io_uring
+ * @param   size        Max size of a datagram
+ * @return  The ring, NULL if io_uring is not available or if the thread receives from another socket
+ */
+uring_t uringThreadRecv(int socket, int size);
+
+/**
+ * @fn      void uringThreadExit()
+ * @brief   Destroys the rings of the calling thread, once it no longer sends or receives
+ */
+void uringThreadExit();
+
+/*///////////*/
+/* FUNCTIONS */
+/*///////////*/
+
+/**
+ * @fn      int uringEnter(uring_t ring, unsigned submit, unsigned wait)
+ * @brief   Submits what has been queued and waits for completions
+ * @param   ring        Ring
+ * @param   submit      Number of submissions queued
+ * @param   wait        Number of completions to wait for, 0 to only submit
+ * @return  -1 if an error has occurred (errno set), else the number of submissions consumed
+ */
+int uringEnter(uring_t ring, unsigned submit, unsigned wait)
+{
+    return (int) syscall(__NR_io_uring_enter, ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/**
+ * @fn      int uringQueue(uring_t ring, const struct io_uring_sqe *sqe)
+ * @brief   Queues a submission, the kernel reads it with the next uringEnter
+ * @param   ring        Ring
+ * @param   sqe         Submission
+ * @return  -1 if the submission queue is full, else 0
+ */
+int uringQueue(uring_t ring, const struct io_uring_sqe *sqe)
+{
+    unsigned tail = *ring->sqTail;
+    if(tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) > ring->sqMask)
+        return -1;
+
+    unsigned index = tail & ring->sqMask;
+    ring->sqes[index] = *sqe;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE); // the kernel sees the submission once it is written
+    return 0;
+}
+
+/**
+ * @fn      struct io_uring_cqe *uringPeek(uring_t ring)
+ * @brief   Oldest completion, it stays there until uringSeen
+ * @param   ring        Ring
+ * @return  The completion, NULL if there is none
+ */
+struct io_uring_cqe *uringPeek(uring_t ring)
+{
+    unsigned head = *ring->cqHead;
+    if(head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->cqMask];
+}
+
+/**
+ * @fn      void uringSeen(uring_t ring)
+ * @brief   Gives the completion returned by uringPeek back to the kernel
+ * @param   ring        Ring
+ */
+void uringSeen(uring_t ring)
+{
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @fn      void uringRecycle(uring_t ring, unsigned short bid)
+ * @brief   Gives a buffer back to the kernel, once its datagram has been read
+ * @param   ring        Ring armed by uringArm
+ * @param   bid         Index of the buffer
+ */
+void uringRecycle(uring_t ring, unsigned short bid)
+{
+    struct io_uring_buf *buffer = &ring->buffers->bufs[ring->bufferTail & (URING_BUFFERS - 1)];
+    buffer->addr = (uint64_t) (uintptr_t) (ring->bufferData + (size_t) bid * ring->bufferSize);
+    buffer->len = (uint32_t) ring->bufferSize;
+    buffer->bid = bid;
+    ring->bufferTail++;
+    __atomic_store_n(&ring->buffers->tail, ring->bufferTail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @fn      int uringMultishot(uring_t ring)
+ * @brief   Queues and submits the multishot receive, it stops once the kernel runs out of buffers
+ * @param   ring        Ring armed by uringArm
+ * @return  -1 if an error has occurred, else 0
+ */
+int uringMultishot(uring_t ring)
+{
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = ring->socket;
+    sqe.ioprio = IORING_RECV_MULTISHOT; // a completion for each datagram, until it is cancelled
+    sqe.flags = IOSQE_BUFFER_SELECT; // into the buffers we gave the kernel
+    sqe.buf_group = 0;
+    sqe.user_data = URING_TAG_RECV;
+
+    if(uringQueue(ring, &sqe) == -1 || uringEnter(ring, 1, 0) == -1)
+        return -1;
+    ring->armed = 1;
+    return 0;
+}
+
+uring_t newUring(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if(fd == -1)
+        return NULL;
+
+    uring_t ring = calloc(1, sizeof(struct uring));
+    if(ring == NULL)
+        raler("newUring");
+    ring->fd = fd;
+    ring->socket = -1;
+
+    // both queues in a single mapping when the kernel allows it
+    ring->sqLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sqLen = ring->cqLen = MAX(ring->sqLen, ring->cqLen);
+
+    ring->sq = mmap(NULL, ring->sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring->sq == MAP_FAILED)
+        raler("mmap sq");
+    ring->cq = ring->sq;
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq = mmap(NULL, ring->cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(ring->cq == MAP_FAILED)
+            raler("mmap cq");
+    }
+    ring->sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+        raler("mmap sqes");
+
+    char *sq = ring->sq, *cq = ring->cq;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return ring;
+}
+
+void destroyUring(uring_t ring)
+{
+    if(ring == NULL)
+        return;
+
+    // the kernel writes into our buffers until the multishot receive is really over
+    if(ring->armed)
+    {
+        struct io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.addr = URING_TAG_RECV;
+        sqe.user_data = URING_TAG_CANCEL;
+        if(uringQueue(ring, &sqe) == 0 && uringEnter(ring, 1, 0) != -1)
+        {
+            while(ring->armed)
+            {
+                struct io_uring_cqe *cqe = uringPeek(ring);
+                if(cqe == NULL)
+                {
+                    if(uringEnter(ring, 0, 1) == -1 && errno != EINTR)
+                        break;
+                    continue;
+                }
+                if(cqe->user_data == URING_TAG_RECV && !(cqe->flags & IORING_CQE_F_MORE))
+                    ring->armed = 0;
+                uringSeen(ring);
+            }
+        }
+    }
+
+    close(ring->fd);
+    munmap(ring->sqes, ring->sqesLen);
+    if(ring->cq != ring->sq)
+        munmap(ring->cq, ring->cqLen);
+    munmap(ring->sq, ring->sqLen);
+    if(ring->buffers != NULL)
+        munmap(ring->buffers, sizeof(struct io_uring_buf) * URING_BUFFERS);
+    free(ring->bufferData);
+    free(ring);
+}
+
+int uringSend(uring_t ring, int socket, struct mmsghdr *msgs, int nb)
+{
+    nb = MIN(nb, URING_ENTRIES);
+    for(int i = 0; i < nb; ++i)
+    {
+        struct io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_SENDMSG;
+        sqe.fd = socket;
+        sqe.addr = (uint64_t) (uintptr_t) &msgs[i].msg_hdr;
+        sqe.len = 1;
+        sqe.flags = i < nb - 1 ? IOSQE_IO_LINK : 0; // in order : a datagram is sent once the previous one is
+        sqe.user_data = (uint64_t) i;
+        if(uringQueue(ring, &sqe) == -1)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+
+    // the datagrams are read by the kernel until their completion : we wait for all of them
+    if(uringEnter(ring, (unsigned) nb, (unsigned) nb) == -1 && errno != EINTR)
+    {
+        // nothing has been submitted, the kernel never reads them
+        __atomic_store_n(ring->sqTail, __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    // interrupted before submitting all of them
+    unsigned pending;
+    while((pending = *ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE)) > 0)
+        if(uringEnter(ring, pending, 0) == -1 && errno != EINTR)
+            raler("io_uring_enter");
+
+    int sent = 0, error = 0, done = 0;
+    while(done < nb)
+    {
+        struct io_uring_cqe *cqe = uringPeek(ring);
+        if(cqe == NULL)
+        {
+            if(uringEnter(ring, 0, (unsigned) (nb - done)) == -1 && errno != EINTR)
+                raler("io_uring_enter");
+            continue;
+        }
+
+        // after a failure, the following datagrams of the chain are cancelled
+        if(cqe->res >= 0 && error == 0)
+            sent++;
+        else if(error == 0)
+            error = -cqe->res;
+        uringSeen(ring);
+        done++;
+    }
+
+    if(sent == 0 && error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+    return sent;
+}
+
+int uringArm(uring_t ring, int socket, int size)
+{
+    // the ring of buffers is shared with the kernel, aligned on a page
+    ring->buffers = mmap(NULL, sizeof(struct io_uring_buf) * URING_BUFFERS, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring->buffers == MAP_FAILED)
+    {
+        ring->buffers = NULL;
+        return -1;
+    }
+    ring->bufferData = malloc((size_t) size * URING_BUFFERS);
+    if(ring->bufferData == NULL)
+        raler("uringArm");
+    ring->bufferSize = size;
+    ring->socket = socket;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring->buffers;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = 0;
+    if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+        return -1;
+
+    ring->bufferTail = 0;
+    for(unsigned short bid = 0; bid < URING_BUFFERS; ++bid)
+        uringRecycle(ring, bid);
+
+    return uringMultishot(ring);
+}
+
+int uringRecv(uring_t ring, packet_t *packets, int nb)
+{
+    int valid = 0;
+    while(valid == 0)
+    {
+        // nothing received yet : the only system call, waiting for the kernel
+        if(uringPeek(ring) == NULL && uringEnter(ring, 0, 1) == -1)
+            return -1;
+
+        struct io_uring_cqe *cqe;
+        while(valid < nb && (cqe = uringPeek(ring)) != NULL)
+        {
+            if(cqe->user_data == URING_TAG_RECV)
+            {
+                if(cqe->flags & IORING_CQE_F_BUFFER) // a datagram, copied so that its buffer goes back right away
+                {
+                    unsigned short bid = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                    int len = MIN(MAX(cqe->res, 0), ring->bufferSize);
+                    memcpy(packets[valid], ring->bufferData + (size_t) bid * ring->bufferSize, len);
+                    uringRecycle(ring, bid);
+                    if(decodePacket(packets[valid], len) == 0)
+                        valid++;
+                }
+                else if(cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECONNREFUSED && !(cqe->flags & IORING_CQE_F_MORE))
+                {
+                    // the socket failed : like recvmmsg, once everything received has been given
+                    int error = -cqe->res;
+                    ring->armed = 0;
+                    uringSeen(ring);
+                    if(valid > 0)
+                        return valid;
+                    errno = error;
+                    return -1;
+                }
+                // out of buffers : the datagrams wait in the socket until it receives again
+                // connected socket whose peer was not there yet : nothing lost
+                if(!(cqe->flags & IORING_CQE_F_MORE))
+                    ring->armed = 0;
+            }
+            uringSeen(ring);
+        }
+
+        if(!ring->armed && uringMultishot(ring) == -1)
+            return -1;
+    }
+    return valid;
+}
+
+uring_t uringThreadSend()
+{
+    if(uringSendRing == NULL && !(uringTried & 1))
+    {
+        uringTried |= 1;
+        uringSendRing = newUring(URING_ENTRIES);
+        if(uringSendRing == NULL)
+            fprintf(stderr, "io_uring is not available, packets are sent with sendmmsg\n");
+    }
+    return uringSendRing;
+}
+
+uring_t uringThreadRecv(int socket, int size)
+{
+    if(uringRecvRing == NULL && !(uringTried & 2))
+    {
+        uringTried |= 2;
+        uringRecvRing = newUring(URING_ENTRIES);
+        if(uringRecvRing != NULL && uringArm(uringRecvRing, socket, size) == -1)
+        {
+            destroyUring(uringRecvRing);
+            uringRecvRing = NULL;
+        }
+        if(uringRecvRing == NULL)
+            fprintf(stderr, "io_uring is not available, packets are received with recvmmsg\n");
+    }
+    if(uringRecvRing == NULL || uringRecvRing->socket != socket)
+        return NULL;
+    return uringRecvRing;
+}
+
+void uringThreadExit()
+{
+    destroyUring(uringSendRing);
+    destroyUring(uringRecvRing);
+    uringSendRing = NULL;
+    uringRecvRing = NULL;
+}
+
+#endif //_URING_H
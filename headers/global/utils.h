@@ -4,6 +4,11 @@
 #include <stdnoreturn.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
 
 /**
  * @fn      noreturn void raler(char *message)
@@ -21,15 +26,11 @@ noreturn void raler(char *message);
 int string_to_int(char *arg);
 
 /**
- * @fn      void substr(const char *from, char *to, int fromStart, int fromEnd)
- * @brief   Get the sub-string using two indexes
- * @param   from        Original string
- * @param   to          String to store the sub-string
- * @param   fromStart   Index where the sub-string starts
- * @param   fromEnd     Index where the sub-string ends
- * @return  nothing to return, use of pointer
+ * @fn      uint64_t monotonicTime()
+ * @brief   Current time, never goes back (CLOCK_MONOTONIC)
+ * @return  Time in microseconds
  */
-void substr(const char *from, char *to, int fromStart, int fromEnd);
+uint64_t monotonicTime();
 
 /*///////////*/
 /* FUNCTIONS */
@@ -65,19 +66,12 @@ int string_to_int(char *arg)
     return (int) N;
 }
 
-// Not really safe since there is no check concerning the size of "to"
-void substr(const char *from, char *to, int fromStart, int fromEnd)
+uint64_t monotonicTime()
 {
-    int j = 0;
-    int len = fromEnd - fromStart;
-
-    for (int i = 0; i < len; ++i)
-    {
-        if (j >= fromStart && j < fromEnd)
-            to[j++] = from[i];
-        else
-            to[j++] = 0;
-    }
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        raler("clock_gettime");
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 #endif //_UTILS_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // sendmmsg, recvmmsg, getopt
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
@@ -5,17 +6,35 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "../../headers/global/utils.h"
 #include "../../headers/global/packet.h"
+#include "../../headers/global/pool.h"
+#include "../../headers/global/uring.h"
 #include "../../headers/global/socket_utils.h"
+#include "../../headers/global/bitmap.h"
+#include "../../headers/global/buffer.h"
+#include "../../headers/global/ring.h"
 
 #define DEBUG 1
+#define REORDER_MIN_SIZE 64 // packets kept after a gap by a new reorder buffer, power of 2
+#define REORDER_MAX_SIZE (1 << 16) // packets further than this after a gap are dropped, power of 2 : the biggest window
+#define REORDER_MAX_BYTES (1 << 26) // most data kept after a gap by a flux, fewer slots for a big MSS
+#define WORKER_RING_MIN_SIZE 64 // fewest packets waiting for a worker, power of 2
+#define WORKER_RING_BYTES (1 << 24) // most packets waiting for a worker, fewer slots for a big MSS
 
 #if defined(DEBUG) && DEBUG > 0
 #define DEBUG_PRINT(fmt, args...) printf(fmt, ##args)
+#define DEBUG_WRITE(buffer) bufferWrite(buffer, stdout)
 #else
 #define DEBUG_PRINT(fmt, args...) /* Don't do anything in release builds */
+#define DEBUG_WRITE(buffer) /* Don't do anything in release builds */
 #endif
 
 /** @enum status
@@ -31,288 +50,1204 @@ enum status
 };
 typedef enum status status_t;
 
+/** @struct reorder
+ *  @brief Ring of the packets received after a gap, indexed by their sequence number : from last_numSeq + 1
+ *         Their data is kept in place, one MSS for each slot, a bitmap tells which slots hold a packet
+ *         It only exists once a flux has a gap, and only grows with the distance of the packets after it
+ */
+/** @var reorder::data
+ *  Member 'data' contains the data of the packets, slot i at i * mss
+ */
+/** @var reorder::len
+ *  Member 'len' contains the size of the data of each slot
+ */
+/** @var reorder::present
+ *  Member 'present' contains a bit for each slot, set while it holds a packet : duplicates are dropped
+ */
+/** @var reorder::size
+ *  Member 'size' contains the number of slots, power of 2
+ */
+/** @var reorder::max
+ *  Member 'max' contains the sequence number following the furthest packet kept
+ */
+struct reorder
+{
+    char *data;
+    uint16_t *len;
+    uint64_t *present;
+    uint32_t size;
+    uint32_t max;
+};
+
+struct sink_ops;
+
 /** @struct flux
  *  @brief This structure stores information about a flux
  */
 /** @var status_t::status
  *  Member 'status' contains the current status
  */
-/** @var uint16_t::last_numSeq
- *  Member 'last_numSeq' contains the last sequence number received
+/** @var uint32_t::last_numSeq
+ *  Member 'last_numSeq' contains the last sequence number received in order (the SYN's one at first)
+ */
+/** @var uint32_t::numSeq
+ *  Member 'numSeq' contains the sequence number of our last SYN|ACK or FIN, the source acknowledges numSeq + 1
  */
+/** @var  const struct sink_ops *::sink
+*  Member 'sink' contains the functions the data received in order is given to, as soon as it arrives
+*/
 /** @var  size_t::size
-*  Member 'size' contains the size of the current data string
+*  Member 'size' contains the number of bytes given to the sink
+*/
+/** @var  struct buffer::data
+*  Member 'data' contains the message sent since the beginning of the flux, in chunks (memory sink)
+*/
+/** @var  int::fd
+*  Member 'fd' contains the file the message is written to (file sink)
 */
-/** @var  char *::data
-*  Member 'data' contains the message sent since the beginning of the flux
+/** @var  int::mss
+*  Member 'mss' contains the data size negotiated during the handshake
 */
+/** @var struct reorder::reorder
+ *  Member 'reorder' contains the packets received after a gap (selective repeat), NULL until there is one
+ */
 struct flux
 {
     status_t status;
-    uint16_t last_numSeq;
+    uint32_t last_numSeq;
+    uint32_t numSeq;
+    const struct sink_ops *sink;
     size_t size;
-    char *data;
+    struct buffer data;
+    int fd;
+    int mss;
+    struct reorder *reorder;
 };
 typedef struct flux *flux_t;
 
+/** @struct sink_ops
+ *  @brief This structure contains the functions a flux gives its data to, in order and as soon as it arrives
+ */
+/** @var sink_ops::name
+ *  Member 'name' identifies the sink
+ */
+/** @var sink_ops::open
+ *  Member 'open' prepares the sink of a new flux, dir is the output directory chosen by the user
+ */
+/** @var sink_ops::write
+ *  Member 'write' gives the sink the next bytes of the flux
+ */
+/** @var sink_ops::close
+ *  Member 'close' is called once the flux is over, everything has been given to the sink
+ */
+struct sink_ops
+{
+    const char *name;
+    void (*open)(tcp_t tcp, flux_t flux, uint16_t idFlux, const char *dir);
+    void (*write)(tcp_t tcp, flux_t flux, const char *data, size_t len);
+    void (*close)(flux_t flux, uint16_t idFlux);
+};
+
+/**
+ * @fn      void memoryOpen(tcp_t tcp, flux_t flux, uint16_t idFlux, const char *dir)
+ * @brief   Prepares the buffer keeping the whole flux (memory sink)
+ * @param   tcp         TCP structure
+ * @param   flux        New flux
+ * @param   idFlux      Its id
+ * @param   dir         Not used
+ */
+void memoryOpen(tcp_t tcp, flux_t flux, uint16_t idFlux, const char *dir)
+{
+    (void) tcp;
+    (void) idFlux;
+    (void) dir;
+    initBuffer(&flux->data);
+}
+
+/**
+ * @fn      void memoryWrite(tcp_t tcp, flux_t flux, const char *data, size_t len)
+ * @brief   Appends data to the buffer of the flux (memory sink)
+ * @param   tcp         TCP structure
+ * @param   flux        Flux of the data
+ * @param   data        Next bytes of the flux
+ * @param   len         Size of the data
+ */
+void memoryWrite(tcp_t tcp, flux_t flux, const char *data, size_t len)
+{
+    (void) tcp;
+    bufferAppend(&flux->data, data, len);
+}
+
+/**
+ * @fn      void memoryClose(flux_t flux, uint16_t idFlux)
+ * @brief   Displays the whole flux and frees it (memory sink)
+ * @param   flux        Flux over
+ * @param   idFlux      Its id
+ */
+void memoryClose(flux_t flux, uint16_t idFlux)
+{
+    (void) idFlux;
+    flockfile(stdout); // in one piece, whatever the other workers display
+    DEBUG_PRINT("All data received (%zu bytes) : ", flux->size);
+    DEBUG_WRITE(&flux->data);
+    DEBUG_PRINT("\n");
+    funlockfile(stdout);
+    destroyBuffer(&flux->data);
+}
+
+/**
+ * @fn      void fileOpen(tcp_t tcp, flux_t flux, uint16_t idFlux, const char *dir)
+ * @brief   Creates the file dir/flux_<idFlux> the flux is written to (file sink)
+ * @param   tcp         TCP structure
+ * @param   flux        New flux
+ * @param   idFlux      Its id
+ * @param   dir         Output directory
+ */
+void fileOpen(tcp_t tcp, flux_t flux, uint16_t idFlux, const char *dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/flux_%u", dir, idFlux);
+
+    flux->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(flux->fd == -1)
+    {
+        destroyTcp(tcp);
+        raler("open");
+    }
+}
+
+/**
+ * @fn      void fileWrite(tcp_t tcp, flux_t flux, const char *data, size_t len)
+ * @brief   Writes data to the file of the flux right away, nothing is kept (file sink)
+ * @param   tcp         TCP structure
+ * @param   flux        Flux of the data
+ * @param   data        Next bytes of the flux
+ * @param   len         Size of the data
+ */
+void fileWrite(tcp_t tcp, flux_t flux, const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t nb = write(flux->fd, data, len);
+        if(nb == -1 && errno == EINTR)
+            continue;
+        if(nb == -1)
+        {
+            destroyTcp(tcp);
+            raler("write");
+        }
+        data += nb;
+        len -= (size_t) nb;
+    }
+}
+
+/**
+ * @fn      void fileClose(flux_t flux, uint16_t idFlux)
+ * @brief   Closes the file of the flux (file sink)
+ * @param   flux        Flux over
+ * @param   idFlux      Its id
+ */
+void fileClose(flux_t flux, uint16_t idFlux)
+{
+    DEBUG_PRINT("All data received (%zu bytes) : written to flux_%u\n", flux->size, idFlux);
+    close(flux->fd);
+}
+
+const struct sink_ops memorySink = { "memory", memoryOpen, memoryWrite, memoryClose };
+const struct sink_ops fileSink = { "file", fileOpen, fileWrite, fileClose };
+
+/**
+ * @fn      uint32_t reorderFind(struct reorder *reorder, uint32_t seq, uint32_t end, int value)
+ * @brief   First slot from seq to end (excluded) holding a packet, or empty, a word of the bitmap at a time
+ * @param   reorder     Reorder buffer of a flux
+ * @param   seq         Sequence number to start from
+ * @param   end         Sequence number to stop at, at most seq + size
+ * @param   value       1 to find a packet, 0 to find an empty slot
+ * @return  Its sequence number, end if there is none
+ */
+uint32_t reorderFind(struct reorder *reorder, uint32_t seq, uint32_t end, int value)
+{
+    if(!seqBefore(seq, end))
+        return end;
+
+    uint32_t left = (uint32_t) seqDiff(end, seq);
+    uint32_t index = seq & (reorder->size - 1);
+    while(left > 0) /* at most twice : up to the end of the ring, then from its beginning */
+    {
+        uint32_t nb = MIN(left, reorder->size - index);
+        uint32_t found = bitmapFind(reorder->present, index, index + nb, value);
+        if(found < index + nb)
+            return seq + (found - index);
+        seq += nb;
+        left -= nb;
+        index = 0;
+    }
+    return end;
+}
+
+/**
+ * @fn      int sackBlocks(flux_t flux, uint32_t seq, struct sack *blocks)
+ * @brief   Describes the packets kept after a gap as SACK blocks, the one of the packet received first (RFC 2018)
+ * @param   flux        Flux of the packet
+ * @param   seq         Sequence number of the packet received
+ * @param   blocks      Filled with the blocks, room for PACKET_SACK_BLOCKS
+ * @return  The number of blocks
+ */
+int sackBlocks(flux_t flux, uint32_t seq, struct sack *blocks)
+{
+    struct reorder *reorder = flux->reorder;
+    uint32_t first = flux->last_numSeq + 1; // the gap
+    if(reorder == NULL || reorder->size == 0 || !seqBefore(first, reorder->max)) // nothing kept
+        return 0;
+
+    // every run of packets kept, from the gap : the one of the packet received goes first, then the oldest
+    int nb = 1, found = 0;
+    uint32_t start = reorderFind(reorder, first, reorder->max, 1);
+    while(start != reorder->max && (!found || nb < PACKET_SACK_BLOCKS))
+    {
+        uint32_t end = reorderFind(reorder, start, reorder->max, 0);
+        if(!found && !seqBefore(seq, start) && seqBefore(seq, end))
+        {
+            blocks[0] = (struct sack) { start, end };
+            found = 1;
+        }
+        else if(nb < PACKET_SACK_BLOCKS)
+            blocks[nb++] = (struct sack) { start, end };
+        start = reorderFind(reorder, end, reorder->max, 1);
+    }
+
+    if(found)
+        return nb;
+    memmove(blocks, blocks + 1, sizeof(struct sack) * (nb - 1)); // a duplicate : only the oldest ones
+    return nb - 1;
+}
+
+/** @struct acks
+ *  @brief This structure stores the ACKs waiting to be sent, all at once
+ */
+/** @var uint32_t *::handles
+ *  Member 'handles' contains the handle of each ACK in the pool, at most two (ACK, FIN) for each packet received
+ */
+/** @var pool_t::pool
+ *  Member 'pool' contains the ACKs, taken by sendACK and given back once flushACKs sent them, they never carry data
+ */
+/** @var int::nb
+ *  Member 'nb' contains the number of ACKs waiting to be sent
+ */
+struct acks
+{
+    uint32_t handles[2 * PACKET_BATCH_SIZE];
+    pool_t pool;
+    int nb;
+};
+typedef struct acks *acks_t;
+
 /**
- * @fn      uint16_t checkPacket(packet_t packet, flux_t *flux, uint8_t idFlux)
- * @brief   Checks if the numSeq received is the one expected and updates it
- * @param   packet     Packet received
- * @param   *flux      All the fluxes
- * @param   idFlux     Indicates in which flux to search
- * @return  The sequence number
- */
-uint16_t checkPacket(packet_t packet, flux_t *flux, uint8_t idFlux)
-{
-    // stop and wait, no window is needed, same numSeq
-    if(packet->tailleFenetre == 0)
-        return packet->numSequence;
-
-    // go back n, expect numSeq to be lastNumSeq + 1
-    // true -> increment lastNumSeq, new lastNumSeq
-    // false -> same lastNumSeq
-    if(packet->numSequence == flux[idFlux]->last_numSeq + 1 || packet->numSequence == 0)
-        flux[idFlux]->last_numSeq = packet->numSequence;
-    return flux[idFlux]->last_numSeq;
+ * @fn      void flushACKs(tcp_t tcp, acks_t acks)
+ * @brief   Sends every ACK waiting to be sent in a single system call, and gives them back to the pool
+ * @param   tcp         TCP structure
+ * @param   acks        ACKs waiting to be sent
+ */
+void flushACKs(tcp_t tcp, acks_t acks)
+{
+    if(acks->nb == 0)
+        return;
+
+    packet_t packets[2 * PACKET_BATCH_SIZE];
+    for(int i = 0; i < acks->nb; ++i)
+        packets[i] = poolPacket(acks->pool, acks->handles[i]);
+
+    /* send packets */
+    if(sendPackets(tcp->outSocket, packets, acks->nb, tcp->sockaddr) == -1)
+    {
+        destroyTcp(tcp);
+        raler("sendmmsg");
+    }
+    poolFree(acks->pool, acks->handles, (uint32_t) acks->nb);
+    acks->nb = 0;
 }
 
 /**
- * @fn      void sendACK(tcp_t tcp, packet_t packet, flux_t *flux, int doCheck, uint8_t type, int isCustom)
- * @brief   sending ACK to the source depending on multiple parameters
+ * @fn      void sendACK(tcp_t tcp, packet_t packet, flux_t *flux, int doCheck, uint8_t type, int isCustom, acks_t acks)
+ * @brief   Prepares an ACK for the source depending on multiple parameters, it is sent by flushACKs
  * @param   tcp         TCP structure
  * @param   packet      Packet received
  * @param   *flux       All the fluxes
  * @param   doCheck     Boolean if we have to check the sequence number with the last sequence number received (false during the handshakes, else it's true)
  * @param   type        Type of the packet we will be sending
  * @param   isCustom    Boolean if we want to send a random sequence number (true during the handshakes, else it's true)
- * @return  The sequence number
+ * @param   acks        ACKs waiting to be sent
  */
-void sendACK(tcp_t tcp, packet_t packet, flux_t *flux, int doCheck, uint8_t type, int isCustom)
+void sendACK(tcp_t tcp, packet_t packet, flux_t *flux, int doCheck, uint8_t type, int isCustom, acks_t acks)
 {
     // idFlux, bit ECN, windowSize => remains the same
-    uint8_t idFlux = packet->idFlux;
+    uint16_t idFlux = packet->idFlux;
     uint8_t ECN = packet->ECN;
-    uint8_t size = packet->tailleFenetre;
-    uint16_t numSeq = packet->numSequence; /* generally, remain the same */
+    uint32_t size = packet->tailleFenetre;
+    uint32_t numSeq = packet->numSequence; /* generally, remain the same */
     if(isCustom) /* unless it's 3 way hand-shake : random numSeq */
-    {
-        srand(time(NULL));
-        numSeq = rand() % (UINT16_MAX / 2);
-    }
+        numSeq = randomSeq();
 
-    uint16_t numAcq = packet->numSequence + 1; /* unless it's hand-shake */
-    if(doCheck) numAcq = checkPacket(packet, flux, idFlux); /* generally, check lastNumSeq */
+    uint32_t numAcq = packet->numSequence + 1; /* unless it's hand-shake */
+    uint32_t echo = packet->horodatage; /* every packet is answered right away : the source measures the RTT with its own */
+    if(doCheck) /* cumulative : everything up to lastNumSeq is there, the packet itself keeps numSequence */
+        numAcq = flux[idFlux]->last_numSeq;
 
-    DEBUG_PRINT("==========> ACK : idFlux = %d ; type = %d, numSeq = %d, numAcq = %d, ECN = %d, size = %d\n", idFlux, type, numSeq, numAcq, ECN, size);
+    uint16_t mss = 0; /* SYN|ACK : answers with the negotiated MSS */
+    if(type & SYN)
+        mss = flux[idFlux] != NULL ? flux[idFlux]->mss : tcp->mss;
+
+    struct sack blocks[PACKET_SACK_BLOCKS]; /* ACK of data : the packets kept after a gap */
+    int nb_blocks = doCheck ? sackBlocks(flux[idFlux], packet->numSequence, blocks) : 0;
+
+    DEBUG_PRINT("==========> ACK : idFlux = %d ; type = %d, numSeq = %u, numAcq = %u, ECN = %d, size = %u\n", idFlux, type, numSeq, numAcq, ECN, size);
     /* sets packet data */
-    if(setPacket(packet, idFlux, type, numSeq, numAcq, ECN, size, "") == -1)
+    if(setPacket(packet, idFlux, type, numSeq, numAcq, ECN, size, (char *) &mss, mss ? sizeof(mss) : 0) == -1)
     {
-        destroyPacket(packet);
-        closeSocket(tcp->outSocket);
-        closeSocket(tcp->inSocket);
+        destroyTcp(tcp);
         raler("snprintf");
     }
-    /* send packet */
-    if(sendPacket(tcp->outSocket, packet, tcp->sockaddr) == -1)
+    setTimestamp(packet, 0, echo);
+    if(nb_blocks > 0)
+        setSack(packet, blocks, nb_blocks);
+    /* queue packet, sent with the other ACKs of the batch : the ones already queued leave first if the pool is empty */
+    if(poolAlloc(acks->pool, &acks->handles[acks->nb], 1) == 0)
     {
-        destroyPacket(packet);
-        closeSocket(tcp->outSocket);
-        closeSocket(tcp->inSocket);
-        raler("sendto");
+        flushACKs(tcp, acks);
+        if(poolAlloc(acks->pool, &acks->handles[acks->nb], 1) == 0)
+            raler("poolAlloc");
     }
+    memcpy(poolPacket(acks->pool, acks->handles[acks->nb++]), packet, packetSize(packet));
 }
 
 /**
- * @fn      void storeData(tcp_t tcp, flux_t *flux, uint8_t idFlux, char *data)
- * @brief   Get and concat the data received in the flux structure
+ * @fn      void storeData(tcp_t tcp, flux_t *flux, uint16_t idFlux, const char *data, size_t len)
+ * @brief   Gives the data received in order to the sink of the flux (binary safe), as soon as it arrives
  * @param   tcp         TCP structure
  * @param   *flux       All the fluxes
  * @param   idFlux      Indicates in which flux to look
  * @param   *data       The data to add to a specified flux
+ * @param   len         Size of the data
  */
-void storeData(tcp_t tcp, flux_t *flux, uint8_t idFlux, char *data)
+void storeData(tcp_t tcp, flux_t *flux, uint16_t idFlux, const char *data, size_t len)
 {
-    /* flux data size : size = size + data_size */
-    size_t size = flux[idFlux]->size + PACKET_DATA_SIZE;
+    flux[idFlux]->size += len;
+    flux[idFlux]->sink->write(tcp, flux[idFlux], data, len);
+}
 
-    /* reallocs data related to its new size */
-    flux[idFlux]->data = realloc(flux[idFlux]->data, size);
+/**
+ * @fn      uint32_t reorderLimit(int mss)
+ * @brief   Most slots a reorder buffer can have, at most REORDER_MAX_SIZE and REORDER_MAX_BYTES of data
+ * @param   mss         Data size of the packets of the flux
+ * @return  The number of slots, power of 2
+ */
+uint32_t reorderLimit(int mss)
+{
+    uint32_t limit = REORDER_MAX_SIZE;
+    while(limit > REORDER_MIN_SIZE && (size_t) limit * mss > REORDER_MAX_BYTES)
+        limit /= 2;
+    return limit;
+}
 
-    /* update data buffer */
-    char *str = flux[idFlux]->data;
-    size_t r = snprintf(flux[idFlux]->data, size, "%s%s", str, data);
-    if(r >= size) // error while concatening
+/**
+ * @fn      void reorderGrow(tcp_t tcp, flux_t flux, uint32_t needed)
+ * @brief   Doubles the number of slots until needed packets fit after the gap, the packets kept move with it
+ * @param   tcp         TCP structure
+ * @param   flux        Flux of the reorder buffer, allocated
+ * @param   needed      Number of slots, at most reorderLimit
+ */
+void reorderGrow(tcp_t tcp, flux_t flux, uint32_t needed)
+{
+    struct reorder *reorder = flux->reorder;
+    uint32_t size = reorder->size == 0 ? REORDER_MIN_SIZE : reorder->size;
+    while(size < needed)
+        size *= 2;
+
+    char *data = malloc((size_t) size * flux->mss);
+    uint16_t *len = malloc(sizeof(uint16_t) * size);
+    uint64_t *present = calloc(BITMAP_WORDS(size), sizeof(uint64_t));
+    if(data == NULL || len == NULL || present == NULL)
+    {
         destroyTcp(tcp);
+        raler("reorderGrow");
+    }
+
+    /* the index of a packet depends on the size : every packet kept moves */
+    uint32_t first = flux->last_numSeq + 1;
+    for(uint32_t seq = reorder->size == 0 ? reorder->max : reorderFind(reorder, first, reorder->max, 1);
+        seq != reorder->max; seq = reorderFind(reorder, seq + 1, reorder->max, 1))
+    {
+        uint32_t from = seq & (reorder->size - 1), to = seq & (size - 1);
+        memcpy(data + (size_t) to * flux->mss, reorder->data + (size_t) from * flux->mss, reorder->len[from]);
+        len[to] = reorder->len[from];
+        bitmapFill(present, to, to + 1, 1);
+    }
+
+    free(reorder->data);
+    free(reorder->len);
+    free(reorder->present);
+    reorder->data = data;
+    reorder->len = len;
+    reorder->present = present;
+    reorder->size = size;
 }
 
 /**
- * @fn      void handle(tcp_t tcp)
- * @brief   Executes the "destination" mechanism
+ * @fn      void keepData(tcp_t tcp, flux_t *flux, uint16_t idFlux, packet_t packet)
+ * @brief   Keeps the data of a packet received after a gap in its slot, until the packets missing arrive
  * @param   tcp         TCP structure
+ * @param   *flux       All the fluxes
+ * @param   idFlux      Indicates in which flux to look
+ * @param   packet      Packet received, after last_numSeq + 1
  */
-void handle(tcp_t tcp)
+void keepData(tcp_t tcp, flux_t *flux, uint16_t idFlux, packet_t packet)
 {
-    status_t status; // flux status
-    packet_t packet = newPacket(); // alloc TCP packet
-    flux_t *flux = malloc(sizeof(flux_t)*UINT8_MAX);// list of all fluxes
-    uint8_t nb_flux = 0; // current nb of fluxes
+    uint32_t distance = (uint32_t) seqDiff(packet->numSequence, flux[idFlux]->last_numSeq);
+    if(distance > reorderLimit(flux[idFlux]->mss) || packet->tailleDonnees > flux[idFlux]->mss) /* the source will send it again */
+        return;
 
-    while(1)
+    struct reorder *reorder = flux[idFlux]->reorder;
+    if(reorder == NULL) /* first gap of the flux */
     {
-        /* receives a packet */
-        if(recvPacket(packet, tcp->inSocket, 52) == -1)
+        reorder = calloc(1, sizeof(struct reorder));
+        if(reorder == NULL)
         {
-            destroyPacket(packet);
             destroyTcp(tcp);
-            raler("recvfrom");
+            raler("calloc");
         }
-        DEBUG_PRINT("\n========== Packet received ==========\n");
+        reorder->max = flux[idFlux]->last_numSeq + 1;
+        flux[idFlux]->reorder = reorder;
+    }
 
-        // destination is a server so it should'nt close, but in this case we use RST since it's never used
-        // at least that's what the teacher said, in order to close and free everything
-        if(nb_flux == 0 && packet->type == RST) // close TCP
-            break;
+    if(distance > reorder->size)
+        reorderGrow(tcp, flux[idFlux], distance);
 
-        DEBUG_PRINT("Total active fluxes = %d\n", nb_flux);
-        DEBUG_PRINT("Current idFlux = %d\n", packet->idFlux);
+    uint32_t index = packet->numSequence & (reorder->size - 1);
+    if(bitmapTest(reorder->present, index)) /* duplicate */
+        return;
 
-        /* check if the flux already exists and get its status */
-        if(flux[packet->idFlux] != NULL) // already exists, get status
-            status = flux[packet->idFlux]->status;
-        else // doesnt exists yet, default DISCONNECTED
-            status = DISCONNECTED;
+    memcpy(reorder->data + (size_t) index * flux[idFlux]->mss, packet->data, packet->tailleDonnees);
+    reorder->len[index] = packet->tailleDonnees;
+    bitmapFill(reorder->present, index, index + 1, 1);
+    if(seqBefore(reorder->max, packet->numSequence + 1))
+        reorder->max = packet->numSequence + 1;
+}
 
-        if(status == DISCONNECTED)
-            DEBUG_PRINT("Current status = %s\n", "DISCONNECTED");
-        else if(status == WAITING_OPEN)
-            DEBUG_PRINT("Current status = %s\n", "WAITING_OPEN");
-        else if(status == WAITING_CLOSE)
-            DEBUG_PRINT("Current status = %s\n", "WAITING_CLOSE");
-        else
-            DEBUG_PRINT("Current status = %s\n", "ESTABLISHED");
-
-        if(packet->type == ACK)
-            DEBUG_PRINT("Current type = %s\n", "ACK");
-        else if(packet->type == SYN)
-            DEBUG_PRINT("Current type = %s\n", "SYN");
-        else if(packet->type == FIN)
-            DEBUG_PRINT("Current type = %s\n", "FIN");
-        else if(packet->type == RST)
-            DEBUG_PRINT("Current type = %s\n", "RST");
-        else
-            DEBUG_PRINT("Current type = %s\n", "DATA");
+/**
+ * @fn      void deliverData(tcp_t tcp, flux_t *flux, uint16_t idFlux)
+ * @brief   Stores in bulk the packets kept right after last_numSeq : the gap has been filled
+ * @param   tcp         TCP structure
+ * @param   *flux       All the fluxes
+ * @param   idFlux      Indicates in which flux to look
+ */
+void deliverData(tcp_t tcp, flux_t *flux, uint16_t idFlux)
+{
+    struct reorder *reorder = flux[idFlux]->reorder;
+    uint32_t first = flux[idFlux]->last_numSeq + 1;
+    if(reorder == NULL || reorder->size == 0 || !seqBefore(first, reorder->max))
+        return;
+
+    /* the run of packets following the gap, found a word at a time */
+    uint32_t end = reorderFind(reorder, first, reorder->max, 0);
+    if(end == first)
+        return;
+
+    /* a single copy for the packets next to each other in the ring (full MSS) */
+    uint32_t mask = reorder->size - 1;
+    uint32_t seq = first;
+    while(seq != end)
+    {
+        /* next to each other : until the end of the ring, or after a packet shorter than the MSS */
+        uint32_t index = seq & mask, nb = 0;
+        size_t len = 0;
+        do
+            len += reorder->len[index + nb++];
+        while(seq + nb != end && index + nb < reorder->size && reorder->len[index + nb - 1] == flux[idFlux]->mss);
+
+        storeData(tcp, flux, idFlux, reorder->data + (size_t) index * flux[idFlux]->mss, len);
+        bitmapFill(reorder->present, index, index + nb, 0);
+        seq += nb;
+    }
+    flux[idFlux]->last_numSeq = end - 1;
+}
+
+/**
+ * @fn      void receiveData(tcp_t tcp, flux_t *flux, uint16_t idFlux, packet_t packet)
+ * @brief   Stores the data of a packet in order : the one expected and the ones kept after it, else keeps it for later
+ * @param   tcp         TCP structure
+ * @param   *flux       All the fluxes
+ * @param   idFlux      Indicates in which flux to look
+ * @param   packet      Packet received
+ */
+void receiveData(tcp_t tcp, flux_t *flux, uint16_t idFlux, packet_t packet)
+{
+    // the sequence space wraps around : only the distance between both numbers matters
+    int32_t distance = seqDiff(packet->numSequence, flux[idFlux]->last_numSeq);
+    if(distance <= 0) /* duplicate */
+        return;
+    if(distance > 1) /* too early : a gap before it */
+    {
+        keepData(tcp, flux, idFlux, packet);
+        return;
+    }
+
+    /* the one expected, then every packet it was the gap of */
+    storeData(tcp, flux, idFlux, packet->data, packet->tailleDonnees);
+    flux[idFlux]->last_numSeq = packet->numSequence;
+    deliverData(tcp, flux, idFlux);
+}
+
+/**
+ * @fn      void destroyReorder(struct reorder *reorder)
+ * @brief   Frees the packets kept after a gap
+ * @param   reorder     Reorder buffer of a flux, can be NULL
+ */
+void destroyReorder(struct reorder *reorder)
+{
+    if(reorder == NULL)
+        return;
+    free(reorder->data);
+    free(reorder->len);
+    free(reorder->present);
+    free(reorder);
+}
+
+/** @struct worker
+ *  @brief This structure stores information about a worker, driving a share of the fluxes
+ */
+/** @var int::id
+ *  Member 'id' identifies the worker, it drives the fluxes with idFlux % nb_workers == id
+ */
+/** @var int::nb_workers
+ *  Member 'nb_workers' contains the number of workers sharing the fluxes
+ */
+/** @var tcp_t::tcp
+ *  Member 'tcp' contains the tcp structure in order to communicate
+ */
+/** @var const struct sink_ops *::sink
+ *  Member 'sink' contains where the data of the fluxes goes, chosen by the user
+ */
+/** @var const char *::dir
+ *  Member 'dir' contains the output directory (file sink)
+ */
+/** @var flux_t *::flux
+ *  Member 'flux' contains the fluxes of the worker, indexed by idFlux
+ */
+/** @var int::nb_flux
+ *  Member 'nb_flux' contains the number of fluxes of the worker
+ */
+/** @var atomic_int *::nb_active
+ *  Member 'nb_active' contains the number of fluxes of every worker, NULL if there is a single one
+ */
+/** @var ring_t::ring
+ *  Member 'ring' is used to receive the packets of our fluxes from the dispatcher
+ */
+/** @var int::done
+ *  Member 'done' is an eventfd written once the worker is over, the dispatcher stops with the last one
+ */
+/** @var int::socket
+ *  Member 'socket' is the socket the worker receives its packets on by itself, -1 when the dispatcher gives them
+ */
+/** @var int::stop
+ *  Member 'stop' is an eventfd shared by the workers with their own socket, readable once all of them have to stop
+ */
+/** @var struct acks::acks
+ *  Member 'acks' contains the ACKs waiting to be sent, each worker sends its own
+ */
+struct worker
+{
+    int id;
+    int nb_workers;
+    tcp_t tcp;
+    const struct sink_ops *sink;
+    const char *dir;
+    flux_t *flux;
+    int nb_flux;
+    atomic_int *nb_active;
+    ring_t ring;
+    int done;
+    int socket;
+    int stop;
+    struct acks acks;
+};
+
+/**
+ * @fn      void initWorker(struct worker *worker, int id, tcp_t tcp, const struct sink_ops *sink, const char *dir)
+ * @brief   Prepares a worker without any flux, on its own (no ring, no socket, no other worker)
+ * @param   worker      Worker to prepare
+ * @param   id          Its id
+ * @param   tcp         TCP structure
+ * @param   sink        Where the data of the fluxes goes, chosen by the user
+ * @param   dir         Output directory (file sink)
+ */
+void initWorker(struct worker *worker, int id, tcp_t tcp, const struct sink_ops *sink, const char *dir)
+{
+    worker->id = id;
+    worker->nb_workers = 1;
+    worker->tcp = tcp;
+    worker->sink = sink;
+    worker->dir = dir;
+    worker->flux = calloc(PACKET_MAX_FLUX, sizeof(flux_t)); // list of its fluxes, indexed by idFlux
+    if(worker->flux == NULL)
+    {
+        destroyTcp(tcp);
+        raler("calloc");
+    }
+    worker->nb_flux = 0;
+    worker->nb_active = NULL;
+    worker->ring = NULL;
+    worker->done = -1;
+    worker->socket = -1;
+    worker->stop = -1;
+    worker->acks.pool = newPool(2 * PACKET_BATCH_SIZE, PACKET_OPTIONS_SIZE);
+    worker->acks.nb = 0;
+}
+
+/**
+ * @fn      void destroyWorker(struct worker *worker)
+ * @brief   Frees what a worker prepared by initWorker holds, it stopped once every flux was over
+ * @param   worker      Worker to destroy
+ */
+void destroyWorker(struct worker *worker)
+{
+    destroyPool(worker->acks.pool);
+    free(worker->flux);
+}
+
+/**
+ * @fn      int receivePacket(struct worker *worker, packet_t packet)
+ * @brief   Treats a packet received by one of the fluxes of a worker, its ACKs wait in worker->acks
+ * @param   worker      Worker of the flux
+ * @param   packet      Packet received
+ * @return  0 if the worker has to stop (RST without any flux), else 1
+ */
+int receivePacket(struct worker *worker, packet_t packet)
+{
+    tcp_t tcp = worker->tcp;
+    flux_t *flux = worker->flux;
+    status_t status; // flux status
+
+    DEBUG_PRINT("\n========== Packet received ==========\n");
+
+    // destination is a server so it should'nt close, but in this case we use RST since it's never used
+    // at least that's what the teacher said, in order to close and free everything
+    if(worker->nb_flux == 0 && packet->type == RST) // close TCP
+        return 0;
+
+    DEBUG_PRINT("Total active fluxes = %d\n", worker->nb_flux);
+    DEBUG_PRINT("Current idFlux = %d\n", packet->idFlux);
+
+    /* check if the flux already exists and get its status */
+    if(flux[packet->idFlux] != NULL) // already exists, get status
+        status = flux[packet->idFlux]->status;
+    else // doesnt exists yet, default DISCONNECTED
+        status = DISCONNECTED;
 
-        DEBUG_PRINT("numSequence = %d\n", packet->numSequence);
+    if(status == DISCONNECTED)
+        DEBUG_PRINT("Current status = %s\n", "DISCONNECTED");
+    else if(status == WAITING_OPEN)
+        DEBUG_PRINT("Current status = %s\n", "WAITING_OPEN");
+    else if(status == WAITING_CLOSE)
+        DEBUG_PRINT("Current status = %s\n", "WAITING_CLOSE");
+    else
+        DEBUG_PRINT("Current status = %s\n", "ESTABLISHED");
 
-        /* check packet type */
-        if(packet->type == SYN) /* start 3 way hand-shake */
+    if(packet->type == ACK)
+        DEBUG_PRINT("Current type = %s\n", "ACK");
+    else if(packet->type == SYN)
+        DEBUG_PRINT("Current type = %s\n", "SYN");
+    else if(packet->type == FIN)
+        DEBUG_PRINT("Current type = %s\n", "FIN");
+    else if(packet->type == RST)
+        DEBUG_PRINT("Current type = %s\n", "RST");
+    else
+        DEBUG_PRINT("Current type = %s\n", "DATA");
+
+    DEBUG_PRINT("numSequence = %u\n", packet->numSequence);
+
+    /* check packet type */
+    if(packet->type == SYN) /* start 3 way hand-shake */
+    {
+        if(status == ESTABLISHED) /* already connected */
+            return 1;
+
+        // else : want to connect
+
+        if(status == DISCONNECTED) /* flux doesn't exist yet, needs to be created first */
         {
-            if(status == ESTABLISHED) /* already connected */
-                continue;
+            flux[packet->idFlux] = malloc(sizeof(struct flux)); // alloc a new flux
+            flux[packet->idFlux]->sink = worker->sink;
+            flux[packet->idFlux]->size = 0;
+            flux[packet->idFlux]->reorder = NULL;
+            worker->sink->open(tcp, flux[packet->idFlux], packet->idFlux, worker->dir);
+            worker->nb_flux++; // increments the total count of fluxes
+            if(worker->nb_active != NULL)
+                atomic_fetch_add(worker->nb_active, 1);
+        }
+
+        // the first packet of data will follow the SYN, nothing kept from a previous sequence
+        flux[packet->idFlux]->last_numSeq = packet->numSequence;
+        destroyReorder(flux[packet->idFlux]->reorder);
+        flux[packet->idFlux]->reorder = NULL;
 
-            // else : want to connect
+        // MSS : the one announced by the source, unless we can't go that far
+        flux[packet->idFlux]->mss = getMss(packet, tcp->mss);
 
-            if(status == DISCONNECTED) /* flux doesn't exist yet, needs to be created first */
+        sendACK(tcp, packet, flux, 0, SYN | ACK, 1, &worker->acks);
+        flux[packet->idFlux]->numSeq = packet->numSequence;
+        flux[packet->idFlux]->status = WAITING_OPEN; // waiting for ACK from the source to open
+    }
+    else if(packet->type == ACK) /* waiting for ACKs while trying to open/close connection */
+    {
+        if(status == WAITING_OPEN) /* is waiting to be open, not fully connected yet */
+        {
+            if(packet->numAcquittement == flux[packet->idFlux]->numSeq + 1)
+                flux[packet->idFlux]->status = ESTABLISHED;
+            else // SYN ACK needs to be sent again
             {
-                flux[packet->idFlux] = malloc(PACKET_DATA_SIZE); // flux_t ? alloc a new flux
-                flux[packet->idFlux]->last_numSeq = packet->numSequence + 1; // à voir, +1 ?
-                nb_flux++; // increments the total count of fluxes
+                sendACK(tcp, packet, flux, 0, SYN | ACK, 1, &worker->acks);
+                flux[packet->idFlux]->numSeq = packet->numSequence;
+                flux[packet->idFlux]->status = WAITING_OPEN; // waiting for ACK from the source to open
             }
+        } else if(status == WAITING_CLOSE) /* is waiting to be close, not fully closed yet */
+        {
+            if(packet->numAcquittement == flux[packet->idFlux]->numSeq + 1)
+            {
+                DEBUG_PRINT("Flux %d is done\n", packet->idFlux);
+                flux[packet->idFlux]->sink->close(flux[packet->idFlux], packet->idFlux);
+                flux[packet->idFlux]->status = DISCONNECTED;
+                destroyReorder(flux[packet->idFlux]->reorder);
+                free(flux[packet->idFlux]);
+                flux[packet->idFlux] = NULL;
+                worker->nb_flux--; // decrements the total count of fluxes
+                if(worker->nb_active != NULL)
+                    atomic_fetch_sub(worker->nb_active, 1);
+                status = CLOSED;
+            } else // ACK && FIN needs to be sent again
+            {
+                // SEND ACK
+                sendACK(tcp, packet, flux, 0, ACK, 0, &worker->acks); /* no lastSeq check ; ACK ; classic numSeq */
 
-            sendACK(tcp, packet, flux, 0, SYN | ACK, 1);
-            flux[packet->idFlux]->last_numSeq = packet->numSequence;
-            flux[packet->idFlux]->status = WAITING_OPEN; // waiting for ACK from the source to open
+                // SEND FIN
+                sendACK(tcp, packet, flux, 0, FIN, 1, &worker->acks); /* no lastSeq check ; FIN ; random numSeq */
+                flux[packet->idFlux]->numSeq = packet->numSequence;
+
+                flux[packet->idFlux]->status = WAITING_CLOSE; // switch status : waiting for ACK
+            }
         }
-        else if(packet->type == ACK) /* waiting for ACKs while trying to open/close connection */
+    }
+    else if(packet->type == FIN) /* close connection */
+    {
+        if(status == DISCONNECTED) /* already disconnected */
+            return 1;
+
+        // else : ESTABLISHED, WAITING_OPEN, WAITING_CLOSE
+
+        // SEND ACK
+        sendACK(tcp, packet, flux, 0, ACK, 0, &worker->acks); /* no lastSeq check ; ACK ; classic numSeq */
+
+        // SEND FIN
+        sendACK(tcp, packet, flux, 0, FIN, 1, &worker->acks); /* no lastSeq check ; FIN ; random numSeq */
+        flux[packet->idFlux]->numSeq = packet->numSequence;
+
+        flux[packet->idFlux]->status = WAITING_CLOSE; // switch status : waiting for ACK
+    }
+    else
+    {
+        if(status == WAITING_CLOSE) // impossible
+            return 1;
+
+        // no SYN received for this flux, the source will open it again after a timeout
+        if(status == DISCONNECTED)
+            return 1;
+
+        // the source only sends data once it got our SYN|ACK : its ACK has been lost on the way
+        if(status == WAITING_OPEN)
+            flux[packet->idFlux]->status = ESTABLISHED;
+
+        // else : classic packet with data
+
+        // stores data in order, the packets after a gap wait for it to be filled
+        receiveData(tcp, flux, packet->idFlux, packet);
+
+        /* check last numSeq ; classic ACK ; classic numSeq */
+        sendACK(tcp, packet, flux, 1, ACK, 0, &worker->acks);
+    }
+
+    if(status == CLOSED)
+        DEBUG_PRINT("New status = %s\n", "CLOSED");
+    else if(flux[packet->idFlux]->status == DISCONNECTED)
+        DEBUG_PRINT("New status = %s\n", "DISCONNECTED");
+    else if(flux[packet->idFlux]->status == WAITING_OPEN)
+        DEBUG_PRINT("New status = %s\n", "WAITING_OPEN");
+    else if(flux[packet->idFlux]->status == WAITING_CLOSE)
+        DEBUG_PRINT("New status = %s\n", "WAITING_CLOSE");
+    else
+        DEBUG_PRINT("New status = %s\n", "ESTABLISHED");
+
+    return 1;
+}
+
+/**
+ * @fn      void serve(struct worker *worker)
+ * @brief   Receives the packets of the fluxes of a worker on its own socket and treats them, until RST
+ * @param   worker      Worker with a socket
+ */
+void serve(struct worker *worker)
+{
+    tcp_t tcp = worker->tcp;
+    int running = 1; // until RST is received
+
+    // packets received at once, and the ACKs they produce
+    packet_t packets[PACKET_BATCH_SIZE];
+    pool_t received = newPool(PACKET_BATCH_SIZE, PACKET_MAX_DATA_SIZE);
+    if(poolPackets(received, packets, PACKET_BATCH_SIZE) != PACKET_BATCH_SIZE)
+        raler("poolPackets");
+
+    // with other workers on the port : sleeps until a packet arrives or until one of them stops everybody
+    struct pollfd fds[2];
+    fds[0].fd = recvFd(worker->socket, PACKET_MAX_SIZE); // the socket, or the io_uring receiving from it
+    fds[0].events = POLLIN;
+    fds[1].fd = worker->stop;
+    fds[1].events = POLLIN;
+
+    while(running)
+    {
+        // packets cut from a coalesced datagram are still waiting : no need to sleep
+        if(worker->stop != -1 && !recvPending())
         {
-            if(status == WAITING_OPEN) /* is waiting to be open, not fully connected yet */
-            {
-                if(packet->numAcquittement == flux[packet->idFlux]->last_numSeq + 1)
-                    flux[packet->idFlux]->status = ESTABLISHED;
-                else // SYN ACK needs to be sent again
-                {
-                    sendACK(tcp, packet, flux, 0, SYN | ACK, 1);
-                    flux[packet->idFlux]->last_numSeq = packet->numSequence;
-                    flux[packet->idFlux]->status = WAITING_OPEN; // waiting for ACK from the source to open
-                }
-            } else if(status == WAITING_CLOSE) /* is waiting to be close, not fully closed yet */
+            if(poll(fds, 2, -1) == -1)
             {
-                if(packet->numAcquittement == flux[packet->idFlux]->last_numSeq + 1)
-                {
-                    DEBUG_PRINT("Flux %d is done\n", packet->idFlux);
-                    DEBUG_PRINT("All data received : %s\n", flux[packet->idFlux]->data);
-                    flux[packet->idFlux]->status = DISCONNECTED;
-                    free(flux[packet->idFlux]);
-                    nb_flux--; // decrements the total count of fluxes
-                    status = CLOSED;
-                } else // ACK && FIN needs to be sent again
-                {
-                    // SEND ACK
-                    sendACK(tcp, packet, flux, 0, ACK, 0); /* no lastSeq check ; ACK ; classic numSeq */
-
-                    // SEND FIN
-                    sendACK(tcp, packet, flux, 0, FIN, 1); /* no lastSeq check ; FIN ; random numSeq */
-                    flux[packet->idFlux]->last_numSeq = packet->numSequence;
-
-                    flux[packet->idFlux]->status = WAITING_CLOSE; // switch status : waiting for ACK
-                }
+                if(errno == EINTR)
+                    continue;
+                destroyTcp(tcp);
+                raler("poll");
             }
+            if(fds[1].revents & POLLIN)
+                break;
         }
-        else if(packet->type == FIN) /* close connection */
+
+        /* receives every packet already waiting, at least one */
+        int nb_received = recvPackets(packets, worker->socket, PACKET_BATCH_SIZE, PACKET_MAX_SIZE);
+        if(nb_received == -1)
         {
-            if(status == DISCONNECTED) /* already disconnected */
+            destroyTcp(tcp);
+            raler("recvmmsg");
+        }
+
+        for(int i = 0; i < nb_received && running; ++i)
+        {
+            // RST only reaches one of the workers on the port : it stops all of them once none has a flux
+            if(worker->stop != -1 && packets[i]->type == RST)
+            {
+                uint64_t one = 1;
+                if(atomic_load(worker->nb_active) == 0 && write(worker->stop, &one, sizeof(one)) != sizeof(one))
+                    raler("write eventfd");
+                continue;
+            }
+
+            // the flux of another worker : it would get a second state here, whatever steered it to our socket
+            if(packets[i]->idFlux % worker->nb_workers != worker->id)
+            {
+                DEBUG_PRINT("serve: flux=%d belongs to worker %d, packet dropped\n", packets[i]->idFlux, packets[i]->idFlux % worker->nb_workers);
                 continue;
+            }
 
-            // else : ESTABLISHED, WAITING_OPEN, WAITING_CLOSE
+            running = receivePacket(worker, packets[i]);
+        }
+
+        /* one system call for all the ACKs of this batch */
+        flushACKs(tcp, &worker->acks);
+    }
 
-            // SEND ACK
-            sendACK(tcp, packet, flux, 0, ACK, 0); /* no lastSeq check ; ACK ; classic numSeq */
+    destroyPool(received);
+    socketThreadExit();
+}
 
-            // SEND FIN
-            sendACK(tcp, packet, flux, 0, FIN, 1); /* no lastSeq check ; FIN ; random numSeq */
-            flux[packet->idFlux]->last_numSeq = packet->numSequence;
+/**
+ * @fn      void handle(tcp_t tcp, const struct sink_ops *sink, const char *dir)
+ * @brief   Executes the "destination" mechanism, every flux in the calling thread
+ * @param   tcp         TCP structure
+ * @param   sink        Where the data of the fluxes goes, chosen by the user
+ * @param   dir         Output directory (file sink)
+ */
+void handle(tcp_t tcp, const struct sink_ops *sink, const char *dir)
+{
+    struct worker worker;
+    initWorker(&worker, 0, tcp, sink, dir);
+    worker.socket = tcp->inSocket;
+    serve(&worker);
 
-            flux[packet->idFlux]->status = WAITING_CLOSE; // switch status : waiting for ACK
+    DEBUG_PRINT("Close connection\n");
+    destroyWorker(&worker);
+}
+
+/**
+ * @fn      void *doWorker(void *arg)
+ * @brief   Treats the packets of the fluxes of a worker, given by the dispatcher through its ring
+ * @param   arg         Argument send when the thread was created, struct worker in this case
+ */
+void *doWorker(void *arg)
+{
+    struct worker *worker = (struct worker *) arg; // structure
+    int running = 1; // until RST is received
+
+    struct pollfd fds[1];
+    fds[0].fd = worker->ring->eventfd;
+    fds[0].events = POLLIN;
+
+    while(running)
+    {
+        // every packet the dispatcher queued for our fluxes, treated in place
+        packet_t packet;
+        while(running && (packet = ringFront(worker->ring)) != NULL)
+        {
+            running = receivePacket(worker, packet);
+            ringRelease(worker->ring);
+
+            // no more room for the ACKs of another packet
+            if(worker->acks.nb > 2 * PACKET_BATCH_SIZE - 2)
+                flushACKs(worker->tcp, &worker->acks);
         }
-        else
+
+        /* one system call for all the ACKs of the packets waiting */
+        flushACKs(worker->tcp, &worker->acks);
+
+        if(!running || ringPark(worker->ring)) // done, or the dispatcher already sent us something
+            continue;
+
+        // waiting for the dispatcher to wake us up
+        if(poll(fds, 1, -1) == -1 && errno != EINTR)
+            raler("poll");
+        ringUnpark(worker->ring);
+    }
+
+    DEBUG_PRINT("Worker %d is done\n", worker->id);
+    socketThreadExit();
+
+    uint64_t one = 1;
+    if(write(worker->done, &one, sizeof(one)) != sizeof(one))
+        raler("write eventfd");
+    return NULL;
+}
+
+/**
+ * @fn      unsigned int workerRingSize(size_t slotSize)
+ * @brief   Number of slots of the ring of a worker, at most RING_SIZE and WORKER_RING_BYTES of packets
+ * @param   slotSize    Size of a slot, a packet of the negotiated MSS at most
+ * @return  The number of slots, power of 2
+ */
+unsigned int workerRingSize(size_t slotSize)
+{
+    unsigned int size = RING_SIZE;
+    while(size > WORKER_RING_MIN_SIZE && size * slotSize > WORKER_RING_BYTES)
+        size /= 2;
+    return size;
+}
+
+/**
+ * @fn      void handleWorkers(tcp_t tcp, const struct sink_ops *sink, const char *dir, int nb_workers)
+ * @brief   Executes the "destination" mechanism on several threads, each one driving the fluxes with idFlux % nb_workers == id
+ *          The calling thread receives the packets and gives them to the worker of their flux through its ring
+ * @param   tcp         TCP structure
+ * @param   sink        Where the data of the fluxes goes, chosen by the user
+ * @param   dir         Output directory (file sink)
+ * @param   nb_workers  Number of workers (threads)
+ */
+void handleWorkers(tcp_t tcp, const struct sink_ops *sink, const char *dir, int nb_workers)
+{
+    pthread_t *thr_id = malloc(sizeof(pthread_t) * nb_workers); // list of all the threads id, one for each worker
+    struct worker *workers = malloc(sizeof(struct worker) * nb_workers); // list of all the workers
+    atomic_int nb_active; // fluxes of every worker, RST only stops them once there is none
+    atomic_init(&nb_active, 0);
+    if(thr_id == NULL || workers == NULL)
+    {
+        destroyTcp(tcp);
+        raler("malloc");
+    }
+
+    // written by each worker once it is over, we stop with the last one
+    int done = eventfd(0, EFD_CLOEXEC);
+    if(done == -1)
+    {
+        destroyTcp(tcp);
+        raler("eventfd");
+    }
+
+    // a slot holds a whole packet, data included : the biggest MSS the source can negotiate
+    // rounded to keep the packets aligned, they are treated in place
+    size_t slotSize = (MAX(PACKET_CONTROL_SIZE, PACKET_HEADER_SIZE + tcp->mss) + 7) & ~(size_t) 7;
+
+    for(int i = 0; i < nb_workers; ++i)
+    {
+        initWorker(&workers[i], i, tcp, sink, dir);
+        workers[i].nb_workers = nb_workers;
+        workers[i].nb_active = &nb_active;
+        workers[i].ring = newRing(workerRingSize(slotSize), slotSize);
+        workers[i].done = done;
+        if(pthread_create(&thr_id[i], NULL, doWorker, (void *) &workers[i]) > 0)
+            perror("pthread");
+    }
+
+    // packets received at once
+    packet_t packets[PACKET_BATCH_SIZE];
+    pool_t received = newPool(PACKET_BATCH_SIZE, PACKET_MAX_DATA_SIZE);
+    if(poolPackets(received, packets, PACKET_BATCH_SIZE) != PACKET_BATCH_SIZE)
+        raler("poolPackets");
+
+    // sleeps until a packet arrives or until the workers are over
+    struct pollfd fds[2];
+    fds[0].fd = recvFd(tcp->inSocket, PACKET_MAX_SIZE); // the socket, or the io_uring receiving from it
+    fds[0].events = POLLIN;
+    fds[1].fd = done;
+    fds[1].events = POLLIN;
+    int nb_done = 0;
+
+    while(nb_done < nb_workers)
+    {
+        // packets cut from a coalesced datagram are still waiting : no need to sleep
+        fds[1].revents = 0;
+        if(!recvPending() && poll(fds, 2, -1) == -1)
         {
-            if(status == WAITING_CLOSE) // impossible
+            if(errno == EINTR)
                 continue;
+            destroyTcp(tcp);
+            raler("poll");
+        }
+        if(fds[1].revents & POLLIN)
+        {
+            uint64_t count;
+            if(read(done, &count, sizeof(count)) != sizeof(count))
+                raler("read eventfd");
+            nb_done += (int) count;
+            continue;
+        }
 
-            // source thinks connection is open while it is actually not, restart connection
-            if(status == DISCONNECTED || status == WAITING_OPEN)
+        /* receives every packet already waiting, at least one */
+        int nb_received = recvPackets(packets, tcp->inSocket, PACKET_BATCH_SIZE, PACKET_MAX_SIZE);
+        if(nb_received == -1)
+        {
+            destroyTcp(tcp);
+            raler("recvmmsg");
+        }
+
+        for(int i = 0; i < nb_received; ++i)
+        {
+            packet_t packet = packets[i];
+
+            // RST concerns every worker : each one stops, unless a flux opened in the meantime
+            if(packet->type == RST)
             {
-                sendACK(tcp, packet, flux, 0, SYN | ACK, 1);
-                flux[packet->idFlux]->last_numSeq = packet->numSequence;
-                flux[packet->idFlux]->status = WAITING_OPEN; // waiting for ACK from the source to open
+                if(atomic_load(&nb_active) == 0)
+                    for(int j = 0; j < nb_workers; ++j)
+                        ringPush(workers[j].ring, packet, packetSize(packet));
+                continue;
             }
 
-            // else : classic packet with data
-
-            // stores data only if the packet is the one expected
-            if(packet->numSequence == flux[packet->idFlux]->last_numSeq + 1)
-                storeData(tcp, flux, packet->idFlux, packet->data);
+            // bigger than the MSS announced : the source doesn't send such packets
+            if((size_t) packetSize(packet) > slotSize)
+                continue;
 
-            /* check last numSeq ; classic ACK ; classic numSeq */
-            sendACK(tcp, packet, flux, 1, ACK, 0);
+            // the worker is too late when its ring is full : the packet is dropped, like the network would
+            if(ringPush(workers[packet->idFlux % nb_workers].ring, packet, packetSize(packet)) == -1)
+                DEBUG_PRINT("handleWorkers: ring full for flux=%d, packet dropped\n", packet->idFlux);
         }
+    }
 
-        if(status == CLOSED)
-            DEBUG_PRINT("New status = %s\n", "CLOSED");
-        else if(flux[packet->idFlux]->status == DISCONNECTED)
-            DEBUG_PRINT("New status = %s\n", "DISCONNECTED");
-        else if(flux[packet->idFlux]->status == WAITING_OPEN)
-            DEBUG_PRINT("New status = %s\n", "WAITING_OPEN");
-        else if(flux[packet->idFlux]->status == WAITING_CLOSE)
-            DEBUG_PRINT("New status = %s\n", "WAITING_CLOSE");
-        else
-            DEBUG_PRINT("New status = %s\n", "ESTABLISHED");
+    for(int i = 0; i < nb_workers; ++i)
+    {
+        if(pthread_join(thr_id[i], NULL) > 0)
+            perror("pthread_join");
+        destroyRing(workers[i].ring);
+        destroyWorker(&workers[i]);
+    }
+
+    DEBUG_PRINT("Close connection\n");
+    socketThreadExit();
+    close(done);
+    destroyPool(received);
+    free(workers);
+    free(thr_id);
+}
+
+/**
+ * @fn      void *doShard(void *arg)
+ * @brief   Drives the fluxes of a worker from its own socket, nothing goes through another thread
+ * @param   arg         Argument send when the thread was created, struct worker in this case
+ */
+void *doShard(void *arg)
+{
+    struct worker *worker = (struct worker *) arg; // structure
+    serve(worker);
+    DEBUG_PRINT("Worker %d is done\n", worker->id);
+    return NULL;
+}
+
+/**
+ * @fn      void handleShards(tcp_t tcp, const struct sink_ops *sink, const char *dir, int nb_workers, int port_local)
+ * @brief   Executes the "destination" mechanism on several threads, each one with its own socket on the port
+ *          The kernel gives each packet to the socket of the worker idFlux % nb_workers (SO_REUSEPORT)
+ * @param   tcp         TCP structure, its inSocket is replaced by the socket of the first worker
+ * @param   sink        Where the data of the fluxes goes, chosen by the user
+ * @param   dir         Output directory (file sink)
+ * @param   nb_workers  Number of workers (threads)
+ * @param   port_local  Port the packets are received on
+ */
+void handleShards(tcp_t tcp, const struct sink_ops *sink, const char *dir, int nb_workers, int port_local)
+{
+    pthread_t *thr_id = malloc(sizeof(pthread_t) * nb_workers); // list of all the threads id, one for each worker
+    struct worker *workers = malloc(sizeof(struct worker) * nb_workers); // list of all the workers
+    int *sockets = malloc(sizeof(int) * nb_workers); // socket of each worker, picked by the kernel
+    atomic_int nb_active; // fluxes of every worker, RST only stops them once there is none
+    atomic_init(&nb_active, 0);
+    if(thr_id == NULL || workers == NULL || sockets == NULL)
+    {
+        destroyTcp(tcp);
+        raler("malloc");
+    }
+
+    // the port is bound again by the group of sockets, the first one replaces inSocket
+    closeSocket(tcp->inSocket);
+    if(prepareShardedSockets(sockets, nb_workers, port_local) == -1)
+    {
+        closeSocket(tcp->outSocket);
+        raler("prepareShardedSockets");
+    }
+    tcp->inSocket = sockets[0];
+
+    // written by the worker receiving RST, once no worker has a flux
+    int stop = eventfd(0, EFD_CLOEXEC);
+    if(stop == -1)
+    {
+        destroyTcp(tcp);
+        raler("eventfd");
+    }
+
+    for(int i = 0; i < nb_workers; ++i)
+    {
+        initWorker(&workers[i], i, tcp, sink, dir);
+        workers[i].nb_workers = nb_workers;
+        workers[i].nb_active = &nb_active;
+        workers[i].socket = sockets[i];
+        workers[i].stop = stop;
+        if(pthread_create(&thr_id[i], NULL, doShard, (void *) &workers[i]) > 0)
+            perror("pthread");
+    }
+
+    for(int i = 0; i < nb_workers; ++i)
+    {
+        if(pthread_join(thr_id[i], NULL) > 0)
+            perror("pthread_join");
+        destroyWorker(&workers[i]);
+        if(i > 0) // the first one is closed with tcp
+            closeSocket(sockets[i]);
     }
 
     DEBUG_PRINT("Close connection\n");
-    free(flux);
-    destroyPacket(packet); // destroy TCP packet
+    close(stop);
+    free(sockets);
+    free(workers);
+    free(thr_id);
 }
 
 /**
@@ -321,25 +1256,69 @@ void handle(tcp_t tcp)
  */
 int main(int argc, char *argv[])
 {
+    const struct sink_ops *sink = &memorySink; // every flux kept until it is over by default
+    const char *dir = NULL;
+    int nb_workers = 1; // every flux in the main thread by default
+    int shards = 0; // workers fed by the main thread by default, not by the kernel
+    int opt;
+
+    // options : output directory, each flux is written to its file as it arrives, number of workers, their sockets, io_uring and a single connected socket
+    while ((opt = getopt(argc, argv, "o:w:rus")) != -1)
+    {
+        if (opt == 'o')
+        {
+            sink = &fileSink;
+            dir = optarg;
+        }
+        else if (opt == 'w')
+            nb_workers = string_to_int(optarg);
+        else if (opt == 'r')
+            shards = 1;
+        else if (opt == 'u')
+            uringBackend = 1;
+        else if (opt == 's')
+            udpConnected = 1;
+        else
+            argc = 0; // unknown option : usage
+    }
 
     // if : args unvalid
 
-    if (argc < 3)
+    if (argc - optind < 3)
+    {
+        fprintf(stderr, "Usage: %s [-o output_dir] [-w nb_workers [-r]] [-u] [-s] <IP_distante> <port_local> <port_ecoute_dst_pertubateur>\n", argv[0]);
+        exit(1);
+    }
+
+    if (nb_workers < 1 || nb_workers > PACKET_MAX_FLUX)
     {
-        fprintf(stderr, "Usage: %s <IP_distante> <port_local> <port_ecoute_dst_pertubateur>\n", argv[0]);
+        fprintf(stderr, "Usage: nb_workers must be between 1 and %d\n", PACKET_MAX_FLUX);
+        exit(1);
+    }
+
+    if (shards && udpConnected && nb_workers > 1)
+    {
+        fprintf(stderr, "Usage: -r needs a socket for each worker, -s a single one\n");
         exit(1);
     }
 
     // else
 
-    char *ip = argv[1];
-    int port_local = string_to_int(argv[2]);
-    int port_medium = string_to_int(argv[3]);
+    char *ip = argv[optind];
+    int port_local = string_to_int(argv[optind + 1]);
+    int port_medium = string_to_int(argv[optind + 2]);
+
+    DEBUG_PRINT("\nDestination address : %s\nLocal port set at : %d\nDestination port set at : %d\nSink : %s\nWorkers : %d%s\n=================================\n", ip, port_local, port_medium, sink->name, nb_workers, shards && nb_workers > 1 ? " (a socket each)" : "");
 
-    DEBUG_PRINT("\nDestination address : %s\nLocal port set at : %d\nDestination port set at : %d\n=================================\n", ip, port_local, port_medium);
+    srand(time(NULL)); // random initial sequence numbers
 
     tcp_t tcp = createTcp(ip, port_local, port_medium);
-    handle(tcp); // handle destination
+    if (nb_workers == 1)
+        handle(tcp, sink, dir); // handle destination
+    else if (shards)
+        handleShards(tcp, sink, dir, nb_workers, port_local); // handle destination, the fluxes shared by the kernel
+    else
+        handleWorkers(tcp, sink, dir, nb_workers); // handle destination, the fluxes shared by the workers
     destroyTcp(tcp);
 
     return 0;
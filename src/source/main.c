@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // sendmmsg, recvmmsg, getopt
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
@@ -7,14 +8,27 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 #include "../../headers/global/utils.h"
 #include "../../headers/global/packet.h"
+#include "../../headers/global/pool.h"
+#include "../../headers/global/uring.h"
 #include "../../headers/global/socket_utils.h" // needs a TCP structure
+#include "../../headers/global/ring.h"
+#include "../../headers/global/timer.h"
+#include "../../headers/global/rtt.h"
+#include "../../headers/global/congestion.h"
+#include "../../headers/global/bitmap.h"
+#include "../../headers/global/inflight.h"
+#include "../../headers/global/rack.h"
+#include "../../headers/global/pacing.h"
 
-#define TIMEOUT 50000
 #define DEBUG 1
-#define FLUX_NB 3
+#define FLUX_NB 3 // default number of fluxes
+#define LOOP_BURST_SIZE 256 // headers of a window prepared before they are sent
+#define LOSS_DUPACK_THRESHOLD 3 // duplicate ACKs showing a segment is lost (DupThresh, RFC 5681)
 
 #if defined(DEBUG) && DEBUG > 0
 #define DEBUG_PRINT(fmt, args...) printf(fmt, ##args)
@@ -22,8 +36,6 @@
 #define DEBUG_PRINT(fmt, args...) /* Don't do anything in release builds */
 #endif
 
-#define MIN(a,b) (((a)<(b))?(a):(b))
-
 /** @enum flux_status
  *  @brief This enum describes the current status of a flux
  */
@@ -51,15 +63,28 @@ enum packet_status
 };
 typedef enum packet_status packet_status_t;
 
-/** @enum thread_status
- *  @brief This enum describes the current status of the main thread, the manager
+/** @enum congestion_event
+ *  @brief This enum describes what the congestion control of a flux is told about
+ */
+enum congestion_event
+{
+    CC_ACK = 0,         /**< new packets acknowledged */
+    CC_LOSS = 1,        /**< the ACKs show a loss */
+    CC_ECN = 2,         /**< an ACK carries the ECN bit */
+    CC_TIMEOUT = 3      /**< the retransmission timer expired */
+};
+typedef enum congestion_event congestion_event_t;
+
+/** @enum loss_timer
+ *  @brief This enum describes what the timer of a flux is armed for while its segments are in flight (go-back-n, selective repeat)
  */
-enum thread_status
+enum loss_timer
 {
-    START = 0,          /**< the manager is runing */
-    STOP = 1            /**< the manager is not running */
+    TIMER_RTO = 0,      /**< retransmission timeout */
+    TIMER_REORDER = 1,  /**< a hole waits for its reordering window (RACK) */
+    TIMER_PROBE = 2     /**< tail loss probe */
 };
-typedef enum thread_status thread_status_t;
+typedef enum loss_timer loss_timer_t;
 
 /** @enum modeTCP
  *  @brief This enum describes the mechanism chosen by the user
@@ -68,7 +93,8 @@ enum modeTCP
 {
     UNKNOWN = -1,           /**< Mechanism doesn't exists */
     STOP_AND_WAIT = 0,      /**< Stop and wait */
-    GO_BACK_N = 1           /**< Go-bach-n */
+    GO_BACK_N = 1,          /**< Go-bach-n */
+    SELECTIVE_REPEAT = 2    /**< Selective repeat */
 };
 typedef enum modeTCP modeTCP_t; // mode_t already used
 
@@ -84,6 +110,8 @@ modeTCP_t parseMode(char *mode)
         return STOP_AND_WAIT;
     if (strcmp(mode, "go-back-n") == 0)
         return GO_BACK_N;
+    if (strcmp(mode, "selective-repeat") == 0)
+        return SELECTIVE_REPEAT;
     return UNKNOWN; // Default
 }
 
@@ -99,19 +127,19 @@ modeTCP_t parseMode(char *mode)
 /** @var  char *::buf
 *  Member 'buf' contains the string we want to send
 */
-/** @var  int::bufLen
+/** @var  size_t::bufLen
 *  Member 'bufLen' indicates the size of the buffer
 */
 struct flux {
     int fluxId;
     flux_status_t status;
     char *buf;
-    int bufLen;
+    size_t bufLen;
 };
 typedef struct flux *flux_t;
 
-/** @struct flux_args
- *  @brief This structure stores information about a specific flux
+/** @struct flux_state
+ *  @brief This structure stores the state machine of a specific flux, driven by an event loop
  */
 /** @var tcp_t::tcp
  *  Member 'tcp' contains the tcp structure in order to communicate
@@ -119,21 +147,227 @@ typedef struct flux *flux_t;
 /** @var  int::idFlux
 *  Member 'idFlux' identifies a flux
 */
-/** @var int::pipe_read
- *  Member 'pipes' is used to receive packets from the manager
- */
 /** @var  char *::buf
 *  Member 'buf' contains the string we want to send
 */
-/** @var  int::bufLen
+/** @var  size_t::bufLen
 *  Member 'bufLen' indicates the size of the buffer
 */
-struct flux_args {
+/** @var  flux_status_t::status
+*  Member 'status' contains the current status of the flux
+*/
+/** @var  packet_status_t::packet_status
+*  Member 'packet_status' contains the status of the packet being sent (stop and wait)
+*/
+/** @var  int::mss
+*  Member 'mss' contains the data size of a packet, negotiated during the handshake
+*/
+/** @var  uint32_t::sliding_window
+*  Member 'sliding_window' contains the size of the window (go-back-n, selective repeat), given by the congestion control
+*/
+/** @var  uint32_t::isn
+*  Member 'isn' contains the initial sequence number, sent with the SYN
+*/
+/** @var  uint32_t::numSeq
+*  Member 'numSeq' contains the sequence number of the next packet to send (go-back-n), of the current one (stop and wait)
+*/
+/** @var  uint32_t::snd_una
+*  Member 'snd_una' contains the oldest sequence number not acknowledged yet
+*/
+/** @var  uint32_t::snd_max
+*  Member 'snd_max' contains the sequence number following the last packet ever sent (going back doesn't change it)
+*/
+/** @var  uint32_t::snd_end
+*  Member 'snd_end' contains the sequence number following the last packet of the flux
+*/
+/** @var  uint32_t::nb_packets
+*  Member 'nb_packets' contains the number of packets to send
+*/
+/** @var  uint32_t::nb_done_packets
+*  Member 'nb_done_packets' contains the number of packets acknowledged (stop and wait)
+*/
+/** @var  uint32_t::recover
+*  Member 'recover' contains snd_max when the window has last been reduced, losses before it are the same congestion
+*/
+/** @var  uint32_t::recovery_start
+*  Member 'recovery_start' contains the time the window has last been reduced (timestampNow), the holes sent again since are not lost
+*/
+/** @var  uint32_t::dupacks
+*  Member 'dupacks' contains the number of ACKs in a row that did not move the window (duplicate ACKs)
+*/
+/** @var  int::went_back
+*  Member 'went_back' is set once enough duplicate ACKs came after the last one that moved the window
+*/
+/** @var  int::received
+*  Member 'received' is set when ACKs have been received since the flux last acted
+*/
+/** @var  int::paced
+*  Member 'paced' is set once the pacer held back segments the window allows, they leave when the timer pace expires
+*/
+/** @var  loss_timer_t::timer_kind
+*  Member 'timer_kind' tells what the timer is armed for while segments are in flight
+*/
+/** @var  uint64_t::rto_deadline
+*  Member 'rto_deadline' contains the time the RTO expires at (monotonicTime), the ACKs which acknowledge nothing new don't move it
+*/
+/** @var  int::probe
+*  Member 'probe' is set once the tail loss probe timer expired, the flux sends the probe
+*/
+/** @var  int::probed
+*  Member 'probed' is set once a probe has been sent, until an ACK moves the window
+*/
+/** @var  int::pending
+*  Member 'pending' is set while the flux waits in the list of fluxes that will act
+*/
+/** @var  int::over
+*  Member 'over' is set once the connection is closed
+*/
+/** @var  struct timer::timer
+*  Member 'timer' is armed in the wheel of the loop for the next timeout (RTO, handshake, close)
+*/
+/** @var  struct timer::pace
+*  Member 'pace' is armed in the wheel of the loop for the time the pacer lets the next segment leave
+*/
+/** @var  struct rtt::rtt
+*  Member 'rtt' contains the RTT measured with the ACKs, it gives the RTO
+*/
+/** @var  struct congestion::cc
+*  Member 'cc' contains the congestion control state, it gives the window
+*/
+/** @var  struct pacer::pacer
+*  Member 'pacer' contains the pace of the segments, at the rate of the congestion control (go-back-n, selective repeat)
+*/
+/** @var  struct rack::rack
+*  Member 'rack' contains the time based loss detection, the last segment delivered (go-back-n, selective repeat)
+*/
+/** @var  struct inflight::inflight
+*  Member 'inflight' contains the segments sent and not acknowledged yet, when and how many times they have been sent,
+*  and the scoreboard of the SACKs (go-back-n, selective repeat)
+*/
+struct flux_state {
     tcp_t tcp;
     int idFlux;
-    int pipe_read;
     char *buf;
-    int bufLen;
+    size_t bufLen;
+    flux_status_t status;
+    packet_status_t packet_status;
+    int mss;
+    uint32_t sliding_window;
+    uint32_t isn;
+    uint32_t numSeq;
+    uint32_t snd_una;
+    uint32_t snd_max;
+    uint32_t snd_end;
+    uint32_t nb_packets;
+    uint32_t nb_done_packets;
+    uint32_t recover;
+    uint32_t recovery_start;
+    uint32_t dupacks;
+    int went_back;
+    int received;
+    int paced;
+    loss_timer_t timer_kind;
+    uint64_t rto_deadline;
+    int probe;
+    int probed;
+    int pending;
+    int over;
+    struct timer timer;
+    struct timer pace;
+    struct rtt rtt;
+    struct congestion cc;
+    struct pacer pacer;
+    struct inflight inflight;
+    struct rack rack;
+};
+typedef struct flux_state *flux_state_t;
+
+struct loop;
+
+/** @struct flux_ops
+ *  @brief This structure contains the functions driving a flux, one set for each mechanism
+ */
+/** @var flux_ops::receive
+ *  Member 'receive' treats a packet received by the flux
+ */
+/** @var flux_ops::timeout
+ *  Member 'timeout' is called when the timer of the flux expires
+ */
+/** @var flux_ops::step
+ *  Member 'step' sends what the flux has to send and arms its timer, after one or several receive/timeout
+ */
+struct flux_ops
+{
+    void (*receive)(struct loop *loop, flux_state_t flux, packet_t packet);
+    void (*timeout)(struct loop *loop, flux_state_t flux);
+    void (*step)(struct loop *loop, flux_state_t flux);
+};
+
+/** @struct loop
+ *  @brief This structure stores information about an event loop, driving a share of the fluxes
+ */
+/** @var int::id
+ *  Member 'id' identifies the loop, it drives the fluxes with idFlux % nb_loops == id
+ */
+/** @var tcp_t::tcp
+ *  Member 'tcp' contains the tcp structure in order to communicate
+ */
+/** @var const struct flux_ops *::ops
+ *  Member 'ops' contains the functions of the mechanism chosen by the user
+ */
+/** @var ring_t::ring
+ *  Member 'ring' is used to receive the packets of our fluxes from the manager
+ */
+/** @var int::epoll
+ *  Member 'epoll' is used to sleep until the manager wakes us up or the next timeout
+ */
+/** @var wheel_t::wheel
+ *  Member 'wheel' contains the timers of our fluxes
+ */
+/** @var flux_state_t *::fluxes
+ *  Member 'fluxes' contains the fluxes of the loop
+ */
+/** @var int::nb_flux
+ *  Member 'nb_flux' contains the number of fluxes of the loop
+ */
+/** @var int::nb_active
+ *  Member 'nb_active' contains the number of fluxes not over yet
+ */
+/** @var flux_state_t *::all
+ *  Member 'all' contains every flux, indexed by idFlux
+ */
+/** @var packet_t::packet
+ *  Member 'packet' is used to send SYN and FIN packets
+ */
+/** @var packet_t *::burst
+ *  Member 'burst' contains the headers of the current window, sent LOOP_BURST_SIZE at once with their data taken from the buffer
+ */
+/** @var const char **::burst_data
+ *  Member 'burst_data' contains the data of each header of the burst
+ */
+/** @var uint64_t *::burst_time
+ *  Member 'burst_time' contains the time the kernel releases each packet of the burst (SO_TXTIME), 0 : right away
+ */
+/** @var pool_t::pool
+ *  Member 'pool' contains the packets of the loop : the packet, the burst and the one popped from the ring
+ */
+struct loop
+{
+    int id;
+    tcp_t tcp;
+    const struct flux_ops *ops;
+    ring_t ring;
+    int epoll;
+    wheel_t wheel;
+    flux_state_t *fluxes;
+    int nb_flux;
+    int nb_active;
+    flux_state_t *all;
+    packet_t packet;
+    packet_t burst[LOOP_BURST_SIZE];
+    const char *burst_data[LOOP_BURST_SIZE];
+    uint64_t burst_time[LOOP_BURST_SIZE];
+    pool_t pool;
 };
 
 /** @struct manager
@@ -142,658 +376,1284 @@ struct flux_args {
 /** @var tcp_t::tcp
  *  Member 'tcp' contains the tcp structure in order to communicate
  */
-/** @var int *::pipes
- *  Member 'pipes' is used to transfer a received packet to the corresponding flux
+/** @var ring_t *::rings
+ *  Member 'rings' is used to transfer a received packet to the loop of the corresponding flux
  */
+/** @var  int::nb_loops
+*  Member 'nb_loops' contains the number of loops
+*/
 /** @var  int::nb_flux
 *  Member 'nb_flux' contains the number of active fluxes
 */
-/** @var  thread_status_t *::thr_status
-*  Member 'thr_status' contains its current status
+/** @var  int::stop
+*  Member 'stop' is an eventfd, it becomes readable once the manager has to stop
 */
 struct manager
 {
     tcp_t tcp;
-    int *pipes;
+    ring_t *rings;
+    int nb_loops;
     int nb_flux;
-    thread_status_t *thr_status;
+    int stop;
 };
 
 /**
- * @fn      void *doStopWait(void *arg)
- * @brief   Receives packets from the manager trough pipes, treat them  and sends a sequence of packets back (go-back-n mechanism)
- * @param   arg         Argument send when the thread was created, struct flux in this case
+ * @fn      uint32_t countPackets(size_t bufLen, int mss)
+ * @brief   Number of packets needed to send a buffer, at least one
+ * @param   bufLen      Size of the buffer
+ * @param   mss         Data size of a packet
+ * @return  The number of packets
  */
-void *doGoBackN(void *arg)
+uint32_t countPackets(size_t bufLen, int mss)
 {
+    return bufLen == 0 ? 1 : (uint32_t) ((bufLen - 1) / mss + 1);
+}
 
-    // creates flux
-    struct flux_args flux = *(struct flux_args *) arg;
-    flux_status_t status = DISCONNECTED; // flux status by default
+/**
+ * @fn      void congestionEvent(flux_state_t flux, congestion_event_t event, uint32_t acked)
+ * @brief   Tells the congestion control of a flux what happened, and updates its window and its pacing rate
+ *          (go-back-n, selective repeat)
+ * @param   flux        Flux concerned
+ * @param   event       What happened
+ * @param   acked       Number of packets acknowledged (CC_ACK)
+ */
+void congestionEvent(flux_state_t flux, congestion_event_t event, uint32_t acked)
+{
+    uint64_t now = monotonicTime();
+    uint32_t inflight = inflightCount(&flux->inflight);
+    struct congestion *cc = &flux->cc;
 
-    // creates a packet
-    packet_t packet = newPacket();
+    if (event == CC_ACK)
+        cc->ops->on_ack(cc, acked, inflight, &flux->rtt, now);
+    else if (event == CC_TIMEOUT)
+    {
+        cc->ops->on_timeout(cc, inflight, now);
+        flux->recover = flux->snd_max;
+        flux->recovery_start = timestampNow();
+    }
+    else if (!seqBefore(flux->snd_una, flux->recover)) // once per window : the packets sent before are the same congestion
+    {
+        if (event == CC_LOSS)
+            cc->ops->on_loss(cc, inflight, now);
+        else
+            cc->ops->on_ecn(cc, inflight, now);
+        flux->recover = flux->snd_max;
+        flux->recovery_start = timestampNow();
+    }
 
-    // variables
-    uint16_t numSeq = 0; // numSeq by default
-    uint8_t sliding_window = 1; // size of the window
-    ssize_t return_value = -1; // error return
+    flux->sliding_window = MIN(congestionWindow(cc), INFLIGHT_MAX_SIZE);
+    pacerRate(&flux->pacer, cc->ops->pacing_rate(cc, &flux->rtt));
+}
 
-    // set counters
-    int nb_packets = (flux.bufLen - 1) / PACKET_DATA_SIZE + 1; // nb packets to send
-    int nb_done_packets = 0; // nb packets already sent
-    int nb_lost_packet = 0; // times lost the same packet
+/**
+ * @fn      uint32_t dupThreshold(flux_state_t flux)
+ * @brief   Number of duplicate ACKs showing a loss : fewer when too few segments are in flight to send that many
+ *          (early retransmit, RFC 5827)
+ * @param   flux        Flux concerned
+ * @return  The threshold, at least one
+ */
+uint32_t dupThreshold(flux_state_t flux)
+{
+    uint32_t inflight = inflightCount(&flux->inflight);
+    return MIN(LOSS_DUPACK_THRESHOLD, inflight > 1 ? inflight - 1 : 1);
+}
 
-    // set timeout : 500 ms
-    struct timeval tv;
+/**
+ * @fn      uint32_t fastRetransmit(flux_state_t flux)
+ * @brief   Marks lost, without waiting for the RTO, the oldest hole after enough duplicate ACKs and the holes
+ *          enough segments sent after them already passed (fast retransmit, RFC 5681, RFC 6675) (selective repeat)
+ * @param   flux        Flux receiving the ACKs
+ * @return  The number of segments marked lost
+ */
+uint32_t fastRetransmit(flux_state_t flux)
+{
+    uint32_t threshold = dupThreshold(flux);
+    uint32_t fack = flux->inflight.fack;
+    if (flux->dupacks < threshold && !seqBefore(flux->snd_una + threshold, fack)) // nothing shows a loss
+        return 0;
 
-    // others
-    fd_set working_set; // fd_set used for select
-    char data[PACKET_DATA_SIZE]; // current data to send
+    // during a recovery, the holes sent again since it started are not lost for that : RACK or the RTO tells
+    int recovering = seqBefore(flux->snd_una, flux->recover);
 
-    do
+    uint32_t lost = 0;
+    for (uint32_t seq = flux->snd_una; seq != flux->snd_max; seq = inflightNextHole(&flux->inflight, seq + 1))
     {
+        if (!(seq == flux->snd_una && flux->dupacks >= threshold) && !seqBefore(seq + threshold, fack))
+            break; // the holes after it did not get enough segments past them yet
+        if (!recovering || (int32_t) (inflightGet(&flux->inflight, seq)->sent - flux->recovery_start) <= 0)
+            lost += (uint32_t) inflightLose(&flux->inflight, seq);
+    }
+    return lost;
+}
 
-        if (status == WAITING_ACK) // waiting for all the ACKs of the previous sequence
-        {
-            //DEBUG_PRINT("%d ===== WAITING_ACK =====\n", flux.idFlux);
+/**
+ * @fn      void rtoRestart(flux_state_t flux)
+ * @brief   Starts the RTO of a flux again from now : new data acknowledged, a segment sent while none was in flight,
+ *          or the RTO expired (RFC 6298) (go-back-n, selective repeat)
+ * @param   flux        Flux concerned
+ */
+void rtoRestart(flux_state_t flux)
+{
+    flux->rto_deadline = monotonicTime() + rttTimeout(&flux->rtt);
+}
 
-            // read packet received from manager (trough pipe)
-            if (read(flux.pipe_read, packet, 52) != 52)
-                raler("read pipe");
-            if(flux.idFlux == 0)
-                DEBUG_PRINT("%d ===== Read packet ===== numSeq %d ; numAck %d\n", flux.idFlux, packet->numSequence, packet->numAcquittement);
+/**
+ * @fn      void lossTimer(struct loop *loop, flux_state_t flux)
+ * @brief   Arms the timer of a flux whose segments are in flight for the first of : the reordering window of a hole
+ *          (RACK), the tail loss probe while nothing is known lost, the RTO (go-back-n, selective repeat)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux to arm
+ */
+void lossTimer(struct loop *loop, flux_state_t flux)
+{
+    uint64_t now = monotonicTime();
+    uint64_t expires = flux->rto_deadline; // armed again as it was : only rtoRestart moves it
+    uint64_t reorder = rackTimeout(&flux->rack, timestampNow());
+    flux->timer_kind = TIMER_RTO;
 
-            // receiving the type ACK|SYN here means the ACK we sent has been lost
-            if (packet->type & ACK && packet->type & SYN) // ACK|SYN
-            {
-                status = WAITING_SYN_ACK; // we need to send a new ACK
-                numSeq = 0;
-                sliding_window = 1;
-                return_value = -1;
-                nb_done_packets = 0;
-                nb_lost_packet = 0;
-                //DEBUG_PRINT("%d ---> ACK|SYN Restart handshake : WAITING_ACK to WAITING_SYN_ACK\n", flux.idFlux);
-            }
-            else // it cannot be anything else other than an ACK here
-            {
-                /*// get the previous sliding window value
-                if (numSeq >= (nb_done_packets + sliding_window)) // only true for the first ACK of a sequence
-                    sliding_window = packet->tailleFenetre;*/
-
-                if(flux.idFlux == 0)
-                    DEBUG_PRINT("\t ===== READ ACK %d ===== Window = %d & done = %d | ACK = %d | numSeq = %d\n", flux.idFlux, sliding_window, nb_done_packets, packet->numAcquittement, numSeq);
-
-                if (return_value == 0) // TIMEOUT
-                {
-                    sliding_window /= 2; // size of the sliding window is divided by 2
-                    if(sliding_window < 1) sliding_window = 1;
-                    numSeq = nb_done_packets + 1; // restart sending again from the last received ACK
-                    status = ESTABLISHED; // we need to resend the packet instantly
-                    if(flux.idFlux == 0)
-                        DEBUG_PRINT("\t\t%d ---> TIMEOUT | new window %d | numSeq %d\n", flux.idFlux, sliding_window, numSeq);
-                }
-                else if (nb_done_packets == packet->numAcquittement) // check if numAcq is the one we were expecting
-                {
-                    nb_done_packets++; // this packet is over, it has been acknowledged
-                    nb_lost_packet = 0; // reset the counter we are done with it
-                    sliding_window++; // one more packet can fit in the sliding window
-
-                    if(flux.idFlux == 0)
-                        DEBUG_PRINT("\t\t\t%d ---> packets already done %d | new window %d\n", flux.idFlux, nb_done_packets, sliding_window);
-
-                    if (nb_done_packets >= nb_packets) // if every packet has been sent, we are done here
-                    {
-                        status = TERM_SEND_FIN; // we start the close connection process
-                        //DEBUG_PRINT("%d ---> Start FIN | WAITING_ACK to TERM_SEND_FIN\n", flux.idFlux);
-                    }
-                    else if (numSeq == nb_done_packets) // true if we received all the ACKs we were supposed to
-                    {
-                        status = ESTABLISHED; // we start a new sequence of packet to send
-                        //numSeq = 0;
-                        if(flux.idFlux == 0)
-                            DEBUG_PRINT("\t\t\t%d ---> all ACKs -> new Sequence | WAITING_ACK to ESTABLISHED\n", flux.idFlux);
-                    }
-                }
-                else // not the ACK we expected, we lost a packet
-                {
-                    numSeq = packet->numAcquittement + 1; // restart sending again from the last received ACK
-                    nb_lost_packet++;
-
-                    if (nb_lost_packet == 3) // if we lost 3x the same packet
-                    {
-                        sliding_window = 1; // reset sliding window to 1
-                        nb_lost_packet = 0;
-                    }
-
-                    status = ESTABLISHED; // we need to resend the packet instantly
-                    if(flux.idFlux == 0)
-                        DEBUG_PRINT("\t\t%d ---> LOST | done = %d and lost = %d\n", flux.idFlux, nb_done_packets, nb_lost_packet);
-                }
-
-                if (packet->ECN == ECN_ACTIVE) // ECN is active
-                {
-                    sliding_window = (uint8_t) (sliding_window * 0.90); // -10%, rounded down by cast
-                    DEBUG_PRINT("%d ---> ECN | new window %d\n", flux.idFlux, sliding_window);
-                }
-                if(flux.idFlux == 0)
-                    DEBUG_PRINT("\t ===== STOP READ %d ===== WINDOW = %d\n", flux.idFlux, sliding_window);
-            }
+    if (reorder > 0 && now + reorder < expires)
+    {
+        expires = now + reorder;
+        flux->timer_kind = TIMER_REORDER;
+    }
+    else if (!flux->probed && flux->rtt.measured && flux->inflight.nb_lost == 0 && !seqBefore(flux->snd_una, flux->recover))
+    {
+        // the last segments lost, no ACK would ever show it : one of them is sent again after two RTTs (RFC 8985)
+        uint64_t probe = now + 2 * (uint64_t) flux->rtt.srtt;
+        if (probe < expires)
+        {
+            expires = probe;
+            flux->timer_kind = TIMER_PROBE;
         }
+    }
+
+    wheelArm(loop->wheel, &flux->timer, expires);
+}
+
+/**
+ * @fn      void closeReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+ * @brief   Continues the close connection process with a packet received (every mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux receiving the packet
+ * @param   packet      Packet received
+ */
+void closeReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+{
+    // waiting for FIN in order to send the last ACK
+    if (flux->status == TERM_WAIT_FIN && packet->type & FIN)
+    {
+        wheelCancel(loop->wheel, &flux->timer); // the step arms it for the new status
+        setPacket(packet, flux->idFlux, ACK, packet->numSequence, packet->numSequence + 1, ECN_DISABLED,
+                  flux->sliding_window, "", 0);
+        sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+        flux->status = TERM_WAIT_TERM; // last step before the end
+        //DEBUG_PRINT("%d ---> Wait FIN : TERM_WAIT_FIN to TERM_WAIT_TERM\n", flux->idFlux);
+    }
+
+    // we sent FIN and are waiting for its ACK
+    if (flux->status == TERM_WAIT_ACK && packet->type & ACK)
+    {
+        wheelCancel(loop->wheel, &flux->timer);
+        flux->status = TERM_WAIT_FIN; // continue the close connection process
+        //DEBUG_PRINT("%d ---> Wait ACK (FIN) : TERM_WAIT_ACK to TERM_WAIT_FIN\n", flux->idFlux);
+    }
+}
+
+/**
+ * @fn      void closeTimeout(flux_state_t flux)
+ * @brief   Continues the close connection process after a timeout (every mechanism)
+ * @param   flux        Flux whose timer expired
+ */
+void closeTimeout(flux_state_t flux)
+{
+    if (flux->status == TERM_WAIT_ACK || flux->status == TERM_WAIT_FIN) // we need to restart the close connection process
+    {
+        flux->status = TERM_SEND_FIN;
+        //DEBUG_PRINT("%d ---> TIMEOUT : to TERM_SEND_FIN\n", flux->idFlux);
+    }
+    else if (flux->status == TERM_WAIT_TERM) // closing process has succeeded
+    {
+        flux->over = 1;
+        DEBUG_PRINT("========== %d IS OVER ==========\n", flux->idFlux);
+    }
+}
+
+/**
+ * @fn      void connectReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+ * @brief   Continues the open connection process with a packet received (go-back-n, selective repeat)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux receiving the packet, WAITING_SYN_ACK
+ * @param   packet      Packet received
+ */
+void connectReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+{
+    // we expect the type to be ACK|SYN in order to continue
+    if (!(packet->type & ACK) || !(packet->type & SYN)) // not ACK|SYN
+    {
+        flux->status = DISCONNECTED; // we need to restart the connection process
+        //DEBUG_PRINT("%d ---> not ACK|SYN : WAITING_SYN_ACK to DISCONNECTED\n", flux->idFlux);
+        return;
+    }
+
+    // ACK|SYN : process normally and send ACK
+    // the destination answers with the MSS both sides agree on, and the horodatage of our SYN
+    rttAck(&flux->rtt, packet);
+    flux->mss = getMss(packet, flux->tcp->mss);
+    flux->nb_packets = countPackets(flux->bufLen, flux->mss);
+
+    setPacket(packet, flux->idFlux, ACK, packet->numSequence, packet->numSequence + 1, packet->ECN,
+              packet->tailleFenetre, "", 0);
+    sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+    flux->status = ESTABLISHED;
+    wheelCancel(loop->wheel, &flux->timer); // the first segment arms it
+
+    // the first packet of the flux follows the SYN
+    flux->numSeq = flux->isn + 1;
+    flux->snd_una = flux->numSeq;
+    flux->snd_max = flux->numSeq;
+    flux->snd_end = flux->numSeq + flux->nb_packets;
+    flux->recover = flux->numSeq;
+    flux->dupacks = 0;
+    flux->probe = 0;
+    flux->probed = 0;
+    initInflight(&flux->inflight, flux->numSeq);
+    initRack(&flux->rack);
+    //DEBUG_PRINT("%d ---> ACK sent | WAITING_SYN_ACK to ESTABLISHED\n", flux->idFlux);
+}
+
+/**
+ * @fn      void connectStep(struct loop *loop, flux_state_t flux)
+ * @brief   Sends the SYN of a flux DISCONNECTED (go-back-n, selective repeat)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux to drive
+ */
+void connectStep(struct loop *loop, flux_state_t flux)
+{
+    packet_t packet = loop->packet;
+
+    if (flux->status != DISCONNECTED) // not about to start the connection
+        return;
+
+    // reset variables in case there was an issue somewhere
+    uint16_t mss_option = flux->tcp->mss; // MSS we announce in the SYN
+    initCongestion(&flux->cc, flux->cc.ops); // a new connection starts from the initial window
+    flux->sliding_window = MIN(congestionWindow(&flux->cc), INFLIGHT_MAX_SIZE);
+    initPacer(&flux->pacer, flux->pacer.mode); // not paced until the first RTT
+    flux->went_back = 0;
+
+    flux->isn = randomSeq();
+    setPacket(packet, flux->idFlux, SYN, flux->isn, 0, ECN_DISABLED, flux->sliding_window, (char *) &mss_option,
+              sizeof(mss_option));
+    setTimestamp(packet, timestampNow(), 0);
+    sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+    flux->status = WAITING_SYN_ACK; // now waiting for a packet with SYN|ACK
+
+    //DEBUG_PRINT("%d ---> DISCONNECTED to WAITING_SYN_ACK\n", flux->idFlux);
+}
+
+/**
+ * @fn      void closeStep(struct loop *loop, flux_state_t flux)
+ * @brief   Sends the FIN of a flux TERM_SEND_FIN (go-back-n, selective repeat)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux to drive
+ */
+void closeStep(struct loop *loop, flux_state_t flux)
+{
+    packet_t packet = loop->packet;
+
+    if (flux->status != TERM_SEND_FIN) // not about to close the connection
+        return;
+
+    setPacket(packet, flux->idFlux, FIN, flux->snd_end, 0, ECN_DISABLED, flux->sliding_window, "", 0);
+    setTimestamp(packet, timestampNow(), 0);
+    sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+    flux->status = TERM_WAIT_ACK; // now waiting for a packet with ACK
+
+    //DEBUG_PRINT("%d ---> TERM_SEND_FIN to TERM_WAIT_ACK\n", flux->idFlux);
+}
+
+/**
+ * @fn      void burstSegment(struct loop *loop, flux_state_t flux, int *nb_burst, uint32_t seq, uint32_t now)
+ * @brief   Prepares the header of a segment in the burst of the loop, the burst leaves once full, the pacer books its time
+ *          (go-back-n, selective repeat)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux sending the segment
+ * @param   *nb_burst   Number of headers in the burst
+ * @param   seq         Sequence number of the segment
+ * @param   now         Time it is sent (timestampNow)
+ */
+void burstSegment(struct loop *loop, flux_state_t flux, int *nb_burst, uint32_t seq, uint32_t now)
+{
+    // get the corresponding data we need to send, no copy : it is sent from the buffer
+    size_t offset = (size_t) (seq - (flux->isn + 1)) * flux->mss; // position of the packet in the flux
+    const char *data = flux->buf + offset;
+    uint16_t len = MIN((size_t) flux->mss, flux->bufLen - offset);
+
+    if(flux->idFlux == 0)
+        DEBUG_PRINT("\t\t%d ---> MESSAGE = %u %.*s\n", flux->idFlux, seq, len, data);
+
+    // prepare the header, it will be sent with the rest of the window
+    setHeader(loop->burst[*nb_burst], flux->idFlux, 0, seq, 0, ECN_DISABLED, flux->sliding_window, len);
+    setTimestamp(loop->burst[*nb_burst], now, 0);
+    loop->burst_time[*nb_burst] = pacerSend(&flux->pacer);
+    loop->burst_data[(*nb_burst)++] = data;
+    inflightSend(&flux->inflight, seq, now);
+
+    // a big window leaves LOOP_BURST_SIZE packets at a time
+    if (*nb_burst == LOOP_BURST_SIZE)
+    {
+        if (sendSegments(flux->tcp->outSocket, loop->burst, loop->burst_data, loop->burst_time, *nb_burst, flux->tcp->sockaddr) == -1)
+            raler("sendmmsg");
+        *nb_burst = 0;
+    }
+}
+
+/**
+ * @fn      void probeSegment(struct loop *loop, flux_state_t flux, int *nb_burst, uint32_t seq, uint32_t now)
+ * @brief   Sends the tail loss probe in the burst of the loop, its ACK shows the segments lost before it (go-back-n, selective repeat)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux whose probe timer expired
+ * @param   *nb_burst   Number of headers in the burst
+ * @param   seq         Sequence number of the probe : a new segment, else the last one sent
+ * @param   now         Time it is sent (timestampNow)
+ */
+void probeSegment(struct loop *loop, flux_state_t flux, int *nb_burst, uint32_t seq, uint32_t now)
+{
+    flux->probe = 0;
+    flux->probed = 1; // a single probe until the window moves
+    if (!seqBefore(seq, flux->inflight.una) && !inflightSacked(&flux->inflight, seq)) // nothing if it already arrived
+        burstSegment(loop, flux, nb_burst, seq, now);
+}
+
+/**
+ * @fn      uint32_t sackReceive(flux_state_t flux, packet_t packet)
+ * @brief   Marks in the scoreboard the segments the SACK blocks of an ACK acknowledge (go-back-n, selective repeat)
+ * @param   flux        Flux receiving the ACK
+ * @param   packet      ACK received
+ * @return  The number of segments acknowledged by these blocks only
+ */
+uint32_t sackReceive(flux_state_t flux, packet_t packet)
+{
+    struct sack blocks[PACKET_SACK_BLOCKS];
+    int nb_blocks = getSack(packet, blocks);
+    uint32_t acked = 0;
+
+    for (int i = 0; i < nb_blocks; ++i)
+        acked += inflightSack(&flux->inflight, blocks[i].start, blocks[i].end);
+    return acked;
+}
+
+/**
+ * @fn      void goBackNReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+ * @brief   Treats a packet received by a flux (go-back-n mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux receiving the packet
+ * @param   packet      Packet received
+ */
+void goBackNReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+{
+    if (flux->status == WAITING_ACK) // waiting for all the ACKs of the previous sequence
+    {
+        if(flux->idFlux == 0)
+            DEBUG_PRINT("%d ===== Read packet ===== numSeq %u ; numAck %u\n", flux->idFlux, packet->numSequence, packet->numAcquittement);
 
-        if (status == WAITING_SYN_ACK) // trying to establish a connection
+        // receiving the type ACK|SYN here means the ACK we sent has been lost
+        if (packet->type & ACK && packet->type & SYN) // ACK|SYN
         {
+            flux->status = WAITING_SYN_ACK; // we need to send a new ACK
+            //DEBUG_PRINT("%d ---> ACK|SYN Restart handshake : WAITING_ACK to WAITING_SYN_ACK\n", flux->idFlux);
+            return;
+        }
 
-            //DEBUG_PRINT("%d ===== WAITING_SYN_ACK =====\n", flux.idFlux);
+        // it cannot be anything else other than an ACK here
+        flux->received = 1;
+        sackReceive(flux, packet); // the segments after a gap we won't need to send again
+        if(flux->idFlux == 0)
+            DEBUG_PRINT("\t ===== READ ACK %d ===== Window = %u & not acknowledged = %u | ACK = %u | numSeq = %u\n", flux->idFlux, flux->sliding_window, flux->snd_una, packet->numAcquittement, flux->numSeq);
 
-            if (return_value == 0) // TIMEOUT
-            {
-                status = DISCONNECTED; // we need to restart the connection process
-                //DEBUG_PRINT("%d ---> TIMEOUT : WAITING_SYN_ACK to DISCONNECTED\n", flux.idFlux);
-            } else if (return_value > 0) // no timeout : process normally
+        // the ACK carries the last sequence number received in order, it acknowledges everything up to it
+        if (!seqBefore(packet->numAcquittement, flux->snd_una) && seqBefore(packet->numAcquittement, flux->snd_max))
+        {
+            // new data acknowledged : measures the RTT with the echo, else with the segment if it has been sent once (Karn)
+            struct segment *segment = inflightGet(&flux->inflight, packet->numAcquittement);
+            if (packet->echoHorodatage != 0)
+                rttAck(&flux->rtt, packet);
+            else if (segment != NULL && segment->retransmits == 0)
+                rttSample(&flux->rtt, timestampNow() - segment->sent);
+
+            uint32_t acked = (uint32_t) seqDiff(packet->numAcquittement + 1, flux->snd_una);
+            flux->snd_una = packet->numAcquittement + 1; // these packets are over, they have been acknowledged
+            rtoRestart(flux); // the RTO starts again from this ACK, the step arms it
+            wheelCancel(loop->wheel, &flux->timer);
+            inflightAck(&flux->inflight, flux->snd_una);
+            if (seqBefore(flux->numSeq, flux->snd_una)) // we went back, but the destination already had them
+                flux->numSeq = flux->snd_una;
+            flux->went_back = 0; // older ACKs are not a loss anymore
+            flux->dupacks = 0;
+            flux->probed = 0;
+            congestionEvent(flux, CC_ACK, acked); // the window grows
+
+            if(flux->idFlux == 0)
+                DEBUG_PRINT("\t\t\t%d ---> not acknowledged %u | new window %u\n", flux->idFlux, flux->snd_una, flux->sliding_window);
+
+            if (!seqBefore(flux->snd_una, flux->snd_end)) // if every packet has been sent, we are done here
             {
-                // read packet received from manager (trough pipe)
-                if (read(flux.pipe_read, packet, 52) != 52)
-                    raler("read pipe");
-                //DEBUG_PRINT("%d ===== Read packet =====\n", flux.idFlux);
-
-                // we expect the type to be ACK|SYN in order to continue
-                if (!(packet->type & ACK) || !(packet->type & SYN)) // not ACK|SYN
-                {
-                    status = DISCONNECTED; // we need to restart the connection process
-                    //DEBUG_PRINT("%d ---> not ACK|SYN : WAITING_SYN_ACK to DISCONNECTED\n", flux.idFlux);
-                } else // ACK|SYN : process normally and send ACK
-                {
-                    packet->type = ACK;
-                    packet->numAcquittement = packet->numSequence + 1;
-                    sendPacket(flux.tcp->outSocket, packet, flux.tcp->sockaddr);
-                    status = ESTABLISHED;
-                    numSeq = 0;
-                    //DEBUG_PRINT("%d ---> ACK sent | WAITING_SYN_ACK to ESTABLISHED\n", flux.idFlux);
-                }
+                flux->status = TERM_SEND_FIN; // we start the close connection process
+                //DEBUG_PRINT("%d ---> Start FIN | WAITING_ACK to TERM_SEND_FIN\n", flux->idFlux);
             }
         }
+        else if (++flux->dupacks >= dupThreshold(flux)) // not the ACK we expected : a packet is lost after enough of them
+            flux->went_back = 1;
 
-        if (status == DISCONNECTED) // about to start the connection
+        // the segment it answers arrived : the ones sent long enough before it are lost, whatever the number of ACKs
+        if (packet->echoHorodatage != 0)
+            rackDelivered(&flux->rack, packet->numSequence, packet->echoHorodatage, timestampNow());
+        if (rackDetect(&flux->rack, &flux->inflight, &flux->rtt, timestampNow()) > 0)
+            flux->went_back = 1;
+
+        if (packet->ECN == ECN_ACTIVE) // ECN is active
         {
-            //DEBUG_PRINT("%d ===== DISCONNECTED =====\n", flux.idFlux);
+            congestionEvent(flux, CC_ECN, 0);
+            DEBUG_PRINT("%d ---> ECN | new window %u\n", flux->idFlux, flux->sliding_window);
+        }
+    }
+    else if (flux->status == WAITING_SYN_ACK) // trying to establish a connection
+        connectReceive(loop, flux, packet);
+    else if (flux->status >= TERM_WAIT_ACK && flux->status <= TERM_WAIT_TERM) // continue close connection process
+        closeReceive(loop, flux, packet);
+}
+
+/**
+ * @fn      void goBackNTimeout(struct loop *loop, flux_state_t flux)
+ * @brief   Called when the timer of a flux expires (go-back-n mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux whose timer expired
+ */
+void goBackNTimeout(struct loop *loop, flux_state_t flux)
+{
+    (void) loop;
+
+    if (flux->status == WAITING_ACK && flux->timer_kind == TIMER_PROBE) // nothing came back yet : the step sends a probe
+    {
+        flux->probe = 1;
+        return;
+    }
+    if (flux->status == WAITING_ACK && flux->timer_kind == TIMER_REORDER) // a hole waited long enough
+    {
+        if (rackDetect(&flux->rack, &flux->inflight, &flux->rtt, timestampNow()) > 0)
+            flux->went_back = 1;
+        return;
+    }
 
-            // reset variables in case there was an issue somewhere
-            numSeq = 0;
-            sliding_window = 1;
-            return_value = -1;
-            nb_done_packets = 0;
-            nb_lost_packet = 0;
+    if (flux->status != TERM_WAIT_TERM) // something has been lost : the RTO is doubled until the next measure
+        rttBackoff(&flux->rtt);
 
-            numSeq = rand() % (UINT16_MAX / 2);
-            setPacket(packet, flux.idFlux, SYN, numSeq, 0, ECN_DISABLED, sliding_window, "");
-            sendPacket(flux.tcp->outSocket, packet, flux.tcp->sockaddr);
-            status = WAITING_SYN_ACK; // now waiting for a packet with SYN|ACK
+    if (flux->status == WAITING_ACK)
+    {
+        rtoRestart(flux); // doubled, for the segments sent again
+        congestionEvent(flux, CC_TIMEOUT, 0); // the window shrinks
+        flux->dupacks = 0;
+        flux->numSeq = flux->snd_una; // restart sending again from the oldest packet not acknowledged
+        flux->status = ESTABLISHED; // we need to resend the packet instantly
+        if(flux->idFlux == 0)
+            DEBUG_PRINT("\t\t%d ---> TIMEOUT | new window %u | numSeq %u\n", flux->idFlux, flux->sliding_window, flux->numSeq);
+    }
+    else if (flux->status == WAITING_SYN_ACK)
+    {
+        flux->status = DISCONNECTED; // we need to restart the connection process
+        //DEBUG_PRINT("%d ---> TIMEOUT : WAITING_SYN_ACK to DISCONNECTED\n", flux->idFlux);
+    }
+    else if (flux->status >= TERM_WAIT_ACK && flux->status <= TERM_WAIT_TERM)
+        closeTimeout(flux);
+}
 
-            //DEBUG_PRINT("%d ---> DISCONNECTED to WAITING_SYN_ACK\n", flux.idFlux);
+/**
+ * @fn      void goBackNStep(struct loop *loop, flux_state_t flux)
+ * @brief   Sends a sequence of packets, or whatever the flux has to send, and arms its timer (go-back-n mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux to drive
+ */
+void goBackNStep(struct loop *loop, flux_state_t flux)
+{
+    if (flux->status == WAITING_ACK && (flux->received || flux->went_back)) // every ACK received at once has been treated
+    {
+        if (flux->went_back) // we lost a packet
+        {
+            flux->numSeq = flux->snd_una; // restart sending again from the oldest packet not acknowledged
+            congestionEvent(flux, CC_LOSS, 0); // the window shrinks
+            flux->went_back = 0;
+            flux->dupacks = 0; // the ACKs of the window sent before can't send it again
+
+            flux->status = ESTABLISHED; // we need to resend the packet instantly
+            if(flux->idFlux == 0)
+                DEBUG_PRINT("\t\t%d ---> LOST | not acknowledged = %u | new window %u\n", flux->idFlux, flux->snd_una, flux->sliding_window);
         }
-
-        if (status == ESTABLISHED) // sending a sequence
+        else if (flux->numSeq == flux->snd_una) // true if we received all the ACKs we were supposed to
         {
-            //DEBUG_PRINT("%d ===== ESTABLISHED ====== Start Sequence | WINDOW = %d\n", flux.idFlux, sliding_window);
+            flux->status = ESTABLISHED; // we start a new sequence of packet to send
+            if(flux->idFlux == 0)
+                DEBUG_PRINT("\t\t\t%d ---> all ACKs -> new Sequence | WAITING_ACK to ESTABLISHED\n", flux->idFlux);
+        }
+    }
+    if (flux->status == WAITING_ACK && flux->paced) // the pacer held back the end of the sequence : it goes on
+        flux->status = ESTABLISHED;
+    flux->received = 0;
 
-            // sending packets until we reach the edge of the sliding window
-            if(flux.idFlux == 0)
-                DEBUG_PRINT("\n\t===== START SEQUENCE %d ===== numSeq: %d, nbDonePackets: %d, sliding_window: %d, nb_packets: %d\n", flux.idFlux, numSeq, nb_done_packets, sliding_window, nb_packets);
+    connectStep(loop, flux); // about to start the connection
 
-            while (numSeq < (nb_done_packets + sliding_window) && numSeq < nb_packets)
+    if (flux->status == ESTABLISHED) // sending a sequence
+    {
+        // sending packets until we reach the edge of the sliding window
+        if(flux->idFlux == 0)
+            DEBUG_PRINT("\n\t===== START SEQUENCE %d ===== numSeq: %u, notAcknowledged: %u, sliding_window: %u, nb_packets: %u\n", flux->idFlux, flux->numSeq, flux->snd_una, flux->sliding_window, flux->nb_packets);
+
+        int nb_burst = 0;
+        uint32_t now = timestampNow(); // every packet of the window leaves at once, unless it is paced
+        flux->paced = 0;
+        if (flux->snd_una == flux->snd_max) // nothing in flight : the RTO starts with this sequence
+            rtoRestart(flux);
+        while (seqBefore(flux->numSeq, flux->snd_una + flux->sliding_window) && seqBefore(flux->numSeq, flux->snd_end))
+        {
+            // going back, the destination already has the segments in the SACK blocks : only the holes are sent again
+            if (inflightSacked(&flux->inflight, flux->numSeq))
             {
-                // get the corresponding data we need to send
-                int fromEnd = (numSeq + 1) * PACKET_DATA_SIZE;
-                if (fromEnd > flux.bufLen)
-                    fromEnd = flux.bufLen - fromEnd;
-                substr(flux.buf, data, numSeq * PACKET_DATA_SIZE, fromEnd);
-
-                if(flux.idFlux == 0)
-                    DEBUG_PRINT("\t\t%d ---> MESSAGE = %d %s\n", flux.idFlux, numSeq, data);
-
-                // prepare the packet and sending it
-                setPacket(packet, flux.idFlux, 0, numSeq, 0, ECN_DISABLED, sliding_window, data);
-                sendPacket(flux.tcp->outSocket, packet, flux.tcp->sockaddr);
-                numSeq++; // getting closer the edge of the sliding window
+                flux->numSeq = inflightNextHole(&flux->inflight, flux->numSeq);
+                continue;
             }
-            status = WAITING_ACK; // we need to make some space : waiting for the ACKs
-            if(flux.idFlux == 0)
-                DEBUG_PRINT("\t===== END SEQUENCE %d =====\n", flux.idFlux);
+            if ((flux->paced = pacerHolds(&flux->pacer))) // the rest leaves at the pacing rate
+                break;
+
+            burstSegment(loop, flux, &nb_burst, flux->numSeq, now);
+            flux->numSeq++; // getting closer the edge of the sliding window
         }
+        if (seqBefore(flux->snd_max, flux->numSeq))
+            flux->snd_max = flux->numSeq;
+
+        // the rest of the window
+        if (sendSegments(flux->tcp->outSocket, loop->burst, loop->burst_data, loop->burst_time, nb_burst, flux->tcp->sockaddr) == -1)
+            raler("sendmmsg");
+        flux->status = WAITING_ACK; // we need to make some space : waiting for the ACKs
+        if (flux->paced) // the end of the sequence once the pacer lets it leave
+            wheelArm(loop->wheel, &flux->pace, pacerWake(&flux->pacer));
+        if(flux->idFlux == 0)
+            DEBUG_PRINT("\t===== END SEQUENCE %d =====\n", flux->idFlux);
+    }
+
+    // the probe timer expired while waiting for the ACKs : the last segment of the sequence again
+    if (flux->status == WAITING_ACK && flux->probe)
+    {
+        int nb_burst = 0;
+        probeSegment(loop, flux, &nb_burst, flux->numSeq - 1, timestampNow());
+        if (sendSegments(flux->tcp->outSocket, loop->burst, loop->burst_data, loop->burst_time, nb_burst, flux->tcp->sockaddr) == -1)
+            raler("sendmmsg");
+    }
+    flux->probe = 0;
+
+    closeStep(loop, flux); // about to close the connection
 
-        if (status >= TERM_WAIT_ACK && status <= TERM_WAIT_TERM) // continue close connection process
+    // waiting for the ACKs of a sequence : reordering window, probe or RTO
+    if (flux->status == WAITING_ACK)
+    {
+        lossTimer(loop, flux);
+        return;
+    }
+
+    // 2x longer after the last ACK in the close connection process, the packets which don't move it on keep the deadline
+    uint64_t rto = rttTimeout(&flux->rtt);
+    if (!timerArmed(&flux->timer))
+        wheelArm(loop->wheel, &flux->timer, monotonicTime() + (flux->status == TERM_WAIT_TERM ? 2 * rto : rto));
+}
+
+/**
+ * @fn      void selectiveRepeatReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+ * @brief   Treats a packet received by a flux (selective repeat mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux receiving the packet
+ * @param   packet      Packet received
+ */
+void selectiveRepeatReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+{
+    if (flux->status == ESTABLISHED) // sending the window, each segment is acknowledged on its own
+    {
+        // receiving the type ACK|SYN here means the ACK we sent has been lost
+        if (packet->type & ACK && packet->type & SYN) // ACK|SYN
         {
-            //DEBUG_PRINT("%d ===== TERM_WAIT_ACK - TERM_WAIT_TERM =====\n", flux.idFlux);
+            flux->status = WAITING_SYN_ACK; // we need to send a new ACK
+            return;
+        }
 
-            if (return_value == 0) // TIMEOUT
-            {
-                if (status == TERM_WAIT_ACK ||
-                    status == TERM_WAIT_FIN) // we need to restart the close connection process
-                {
-                    status = TERM_SEND_FIN;
-                    //DEBUG_PRINT("%d ---> TIMEOUT : to TERM_SEND_FIN\n", flux.idFlux);
-                }
-                else if (status == TERM_WAIT_TERM) // closing process has succeeded
-                {
-                    //DEBUG_PRINT("%d ---> TIMEOUT : TERM_WAIT_TERM, thread stopping...\n", flux.idFlux);
-                    break;
-                }
-            }
-            else if (return_value > 0)
-            {
-                // read packet received from manager (trough pipe)
-                if (read(flux.pipe_read, packet, 52) != 52)
-                    raler("read pipe");
-                //DEBUG_PRINT("%d ===== Read packet =====\n", flux.idFlux);
-
-                // waiting for FIN in order to send the last ACK
-                if (status == TERM_WAIT_FIN && packet->type & FIN)
-                {
-                    setPacket(packet, flux.idFlux, ACK, packet->numSequence, packet->numSequence + 1, ECN_DISABLED,
-                              sliding_window, "");
-                    sendPacket(flux.tcp->outSocket, packet, flux.tcp->sockaddr);
-                    status = TERM_WAIT_TERM; // last step before the end
-                    //DEBUG_PRINT("%d ---> Wait FIN : TERM_WAIT_FIN to TERM_WAIT_TERM\n", flux.idFlux);
-                }
-
-                // we sent FIN and are waiting for its ACK
-                if (status == TERM_WAIT_ACK && packet->type & ACK)
-                {
-                    status = TERM_WAIT_FIN; // continue the close connection process
-                    //DEBUG_PRINT("%d ---> Wait ACK (FIN) : TERM_WAIT_ACK to TERM_WAIT_FIN\n", flux.idFlux);
-                }
-            }
+        // it cannot be anything else other than an ACK here
+        flux->received = 1;
+        uint32_t acked = 0;
+
+        // numSequence is the segment the ACK answers : it arrived, even after a gap
+        struct segment *segment = inflightGet(&flux->inflight, packet->numSequence);
+        if (segment != NULL && !inflightSacked(&flux->inflight, packet->numSequence))
+        {
+            // the echo tells which copy arrived, else only a segment sent once can be measured (Karn)
+            if (packet->echoHorodatage != 0)
+                rttAck(&flux->rtt, packet);
+            else if (segment->retransmits == 0)
+                rttSample(&flux->rtt, timestampNow() - segment->sent);
+            acked += inflightSack(&flux->inflight, packet->numSequence, packet->numSequence + 1);
         }
 
-        if (status == TERM_SEND_FIN) // about to close the connection
+        // the SACK blocks and numAcquittement, cumulative : the segments whose own ACK has been lost
+        acked += sackReceive(flux, packet);
+        if (!seqBefore(packet->numAcquittement, flux->snd_una))
+            acked += inflightSack(&flux->inflight, flux->snd_una, packet->numAcquittement + 1);
+
+        // the window moves up to the oldest segment missing, else the ACK is a duplicate
+        uint32_t snd_una = flux->snd_una;
+        flux->snd_una = inflightNextHole(&flux->inflight, flux->snd_una);
+        inflightAck(&flux->inflight, flux->snd_una);
+        if (flux->snd_una != snd_una)
         {
-            //DEBUG_PRINT("%d ===== TERM_SEND_FIN =====\n", flux.idFlux);
+            flux->dupacks = 0;
+            flux->probed = 0;
+            rtoRestart(flux); // new data acknowledged : the RTO starts again from this ACK, the step arms it
+            wheelCancel(loop->wheel, &flux->timer);
+        }
+        else if (flux->snd_una != flux->snd_max)
+            flux->dupacks++;
 
-            numSeq = rand() % (UINT16_MAX / 2);
-            setPacket(packet, flux.idFlux, FIN, numSeq, 0, ECN_DISABLED, sliding_window, "");
-            sendPacket(flux.tcp->outSocket, packet, flux.tcp->sockaddr);
-            status = TERM_WAIT_ACK; // now waiting for a packet with ACK
+        // the holes the ACKs show as lost, by their number or by the time (RACK), are sent again by the step
+        if (packet->echoHorodatage != 0)
+            rackDelivered(&flux->rack, packet->numSequence, packet->echoHorodatage, timestampNow());
+        if (fastRetransmit(flux) + rackDetect(&flux->rack, &flux->inflight, &flux->rtt, timestampNow()) > 0)
+            congestionEvent(flux, CC_LOSS, 0); // halved once for the window, not back to slow start
 
-            //DEBUG_PRINT("%d ---> TERM_SEND_FIN to TERM_WAIT_ACK\n", flux.idFlux);
+        if (acked > 0)
+            congestionEvent(flux, CC_ACK, acked); // the window grows
+
+        if (!seqBefore(flux->snd_una, flux->snd_end)) // if every packet has been acknowledged, we are done here
+            flux->status = TERM_SEND_FIN; // we start the close connection process
+
+        if (packet->ECN == ECN_ACTIVE) // ECN is active
+        {
+            congestionEvent(flux, CC_ECN, 0);
+            DEBUG_PRINT("%d ---> ECN | new window %u\n", flux->idFlux, flux->sliding_window);
         }
+    }
+    else if (flux->status == WAITING_SYN_ACK) // trying to establish a connection
+        connectReceive(loop, flux, packet);
+    else if (flux->status >= TERM_WAIT_ACK && flux->status <= TERM_WAIT_TERM) // continue close connection process
+        closeReceive(loop, flux, packet);
+}
 
-        FD_ZERO(&working_set);
-        FD_SET(flux.pipe_read, &working_set);
+/**
+ * @fn      void selectiveRepeatTimeout(struct loop *loop, flux_state_t flux)
+ * @brief   Called when the timer of a flux expires, marks lost the segments sent for longer than the RTO (selective repeat mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux whose timer expired
+ */
+void selectiveRepeatTimeout(struct loop *loop, flux_state_t flux)
+{
+    (void) loop;
 
-        tv.tv_sec = 0;
-        if(status == TERM_WAIT_TERM) // 2x longer after the last ACK in the close connection process
-            tv.tv_usec = 2 * TIMEOUT;
-        else // one timeout for each packet send
-            tv.tv_usec = TIMEOUT;
+    if (flux->status == ESTABLISHED && flux->timer_kind == TIMER_PROBE) // nothing came back yet : the step sends a probe
+    {
+        flux->probe = 1;
+        return;
+    }
+    if (flux->status == ESTABLISHED && flux->timer_kind == TIMER_REORDER) // a hole waited long enough
+    {
+        if (rackDetect(&flux->rack, &flux->inflight, &flux->rtt, timestampNow()) > 0)
+            congestionEvent(flux, CC_LOSS, 0);
+        return;
+    }
 
-        if(flux.idFlux == 0)
-            DEBUG_PRINT("%d ===== SELECT ===== %d and wait sec = %ld, usec = %ld ", flux.idFlux, flux.pipe_read, tv.tv_sec, tv.tv_usec);
+    if (flux->status == ESTABLISHED)
+    {
+        uint32_t now = timestampNow();
+        uint64_t rto = rttTimeout(&flux->rtt);
+        int loss = 0, timeout = 0;
 
-        // waiting for the manager to send us a packet in order to continue (through pipe)
-        return_value = select(flux.pipe_read + 1, &working_set, NULL, NULL, &tv);
-        if (return_value == -1) raler("select ici\n");
+        // only the holes missing for a whole RTO are sent again
+        for (uint32_t seq = inflightNextHole(&flux->inflight, flux->snd_una); seq != flux->snd_max;
+             seq = inflightNextHole(&flux->inflight, seq + 1))
+        {
+            if (now - inflightGet(&flux->inflight, seq)->sent < rto)
+                continue;
+            inflightLose(&flux->inflight, seq);
+
+            // a segment sent after it has been acknowledged : the ACKs still come, else nothing came back
+            if (seqBefore(seq, flux->inflight.fack))
+                loss = 1;
+            else
+                timeout = 1;
+        }
 
-        if(flux.idFlux == 0)
-            DEBUG_PRINT("%d ===== Received packet ===== ", flux.idFlux);
+        if (timeout) // nothing came back after them : the RTO is doubled until the next measure
+        {
+            rttBackoff(&flux->rtt);
+            flux->dupacks = 0;
+            congestionEvent(flux, CC_TIMEOUT, 0);
+        }
+        else if (loss)
+            congestionEvent(flux, CC_LOSS, 0); // the window shrinks
 
-    } while (1);
+        if(flux->idFlux == 0 && (loss || timeout))
+            DEBUG_PRINT("\t\t%d ---> TIMEOUT | not acknowledged %u | new window %u\n", flux->idFlux, flux->snd_una, flux->sliding_window);
+        rtoRestart(flux); // the next holes get a whole RTO
+        return;
+    }
 
-    DEBUG_PRINT("========== %d IS OVER ==========\n", packet->idFlux);
+    if (flux->status != TERM_WAIT_TERM) // something has been lost : the RTO is doubled until the next measure
+        rttBackoff(&flux->rtt);
 
-    destroyPacket(packet);
-    pthread_exit(NULL);
+    if (flux->status == WAITING_SYN_ACK)
+        flux->status = DISCONNECTED; // we need to restart the connection process
+    else if (flux->status >= TERM_WAIT_ACK && flux->status <= TERM_WAIT_TERM)
+        closeTimeout(flux);
 }
 
 /**
- * @fn      void *doStopWait(void *arg)
- * @brief   Receives the packets from the manager trough pipes, treat it and send a packet back (stop and wait mechanism)
- * @param   arg         Argument send when the thread was created, struct flux in this case
+ * @fn      void selectiveRepeatStep(struct loop *loop, flux_state_t flux)
+ * @brief   Sends the segments lost and the new ones the window allows, or whatever the flux has to send,
+ *          and arms its timer (selective repeat mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux to drive
  */
-void *doStopWait(void *arg)
+void selectiveRepeatStep(struct loop *loop, flux_state_t flux)
 {
-    struct flux_args *flux = (struct flux_args *) arg; // structure
-    flux_status_t status = DISCONNECTED; // flux status by default
+    flux->received = 0;
 
-    packet_t packet = newPacket(); // init a packet used to store and send data
-    packet_status_t packet_status = SEND_PACKET; // packet status by default
+    connectStep(loop, flux); // about to start the connection
 
-    // variables
-    uint16_t numSeq = 0; // numSeq by default
-    struct timeval tv; // set timeout : 500 ms
-    ssize_t return_value = -1; // used to check for timeouts
-    fd_set working_set; // fd_set used for select
-    char data[PACKET_DATA_SIZE]; // current data to send
+    if (flux->status == ESTABLISHED)
+    {
+        int nb_burst = 0;
+        uint32_t now = timestampNow(); // every packet leaves at once, unless it is paced
+        flux->paced = 0;
+        if (flux->snd_una == flux->snd_max) // nothing in flight : the RTO starts with these segments
+            rtoRestart(flux);
+
+        // only the segments lost are sent again, the oldest first
+        for (uint32_t seq = inflightNextLost(&flux->inflight, flux->snd_una); seq != flux->snd_max;
+             seq = inflightNextLost(&flux->inflight, seq + 1))
+        {
+            if ((flux->paced = pacerHolds(&flux->pacer))) // the rest leaves at the pacing rate
+                break;
+            burstSegment(loop, flux, &nb_burst, seq, now); // not lost anymore
+        }
 
-    DEBUG_PRINT("flux flux=%d, Len: %d\n", flux->idFlux, flux->bufLen);
+        // then new segments, while fewer than the window are still in the network : the segments acknowledged
+        // after a hole and the lost ones make room, the window stays open during the recovery (RFC 6675)
+        while (!flux->paced && inflightPipe(&flux->inflight) < flux->sliding_window
+               && seqDiff(flux->snd_max, flux->snd_una) < INFLIGHT_MAX_SIZE && seqBefore(flux->snd_max, flux->snd_end))
+        {
+            if ((flux->paced = pacerHolds(&flux->pacer)))
+                break;
+            burstSegment(loop, flux, &nb_burst, flux->snd_max, now);
+            flux->snd_max++;
+        }
 
-    int nb_packets = (flux->bufLen - 1) / PACKET_DATA_SIZE + 1; // nb packets to send
-    int nb_done_packets = 0; // nb packets already sent
+        // the probe timer expired : a new segment even if the window is full, else the last one sent
+        if (flux->probe && seqBefore(flux->snd_max, flux->snd_end) && seqDiff(flux->snd_max, flux->snd_una) < INFLIGHT_MAX_SIZE)
+            probeSegment(loop, flux, &nb_burst, flux->snd_max++, now);
+        else if (flux->probe)
+            probeSegment(loop, flux, &nb_burst, flux->snd_max - 1, now);
+        flux->numSeq = flux->snd_max;
+
+        if (sendSegments(flux->tcp->outSocket, loop->burst, loop->burst_data, loop->burst_time, nb_burst, flux->tcp->sockaddr) == -1)
+            raler("sendmmsg");
+        if (flux->paced) // the rest once the pacer lets it leave
+            wheelArm(loop->wheel, &flux->pace, pacerWake(&flux->pacer));
+
+        // one timer for the oldest segment : it runs until an ACK shows progress or it expires
+        lossTimer(loop, flux);
+        return;
+    }
+    flux->probe = 0;
 
-    DEBUG_PRINT("Start flux=%d, thread with data=%s (%d packets to send)\n", flux->idFlux, flux->buf, nb_packets);
+    closeStep(loop, flux); // about to close the connection
 
-    do
+    // 2x longer after the last ACK in the close connection process, the packets which don't move it on keep the deadline
+    uint64_t rto = rttTimeout(&flux->rtt);
+    if (!timerArmed(&flux->timer))
+        wheelArm(loop->wheel, &flux->timer, monotonicTime() + (flux->status == TERM_WAIT_TERM ? 2 * rto : rto));
+}
+
+/**
+ * @fn      void stopWaitReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+ * @brief   Treats a packet received by a flux (stop and wait mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux receiving the packet
+ * @param   packet      Packet received
+ */
+void stopWaitReceive(struct loop *loop, flux_state_t flux, packet_t packet)
+{
+    if (flux->status == WAITING_SYN_ACK) // trying to establish a connection
     {
-        if (status == WAITING_SYN_ACK) // trying to establish a connection
+        DEBUG_PRINT("%d ===== WAITING_SYN_ACK =====\n", flux->idFlux);
+
+        // we expect the type to be ACK|SYN in order to continue
+        if (!(packet->type & ACK) || !(packet->type & SYN)) // not ACK|SYN
         {
-            DEBUG_PRINT("%d ===== WAITING_SYN_ACK =====\n", flux->idFlux);
+            flux->status = DISCONNECTED; // we need to restart the connection process
+            DEBUG_PRINT("%d ---> not ACK|SYN : WAITING_SYN_ACK to DISCONNECTED\n", flux->idFlux);
+            return;
+        }
 
-            if (return_value == 0) // TIMEOUT
-            {
-                status = DISCONNECTED; // we need to restart the connection process
-                DEBUG_PRINT("%d ---> TIMEOUT : WAITING_SYN_ACK to DISCONNECTED\n", flux->idFlux);
-            }
-            else if (return_value > 0) // no timeout : process normally
+        // ACK|SYN : process normally and send ACK
+        // the destination answers with the MSS both sides agree on, and the horodatage of our SYN
+        rttAck(&flux->rtt, packet);
+        flux->mss = getMss(packet, flux->tcp->mss);
+        flux->nb_packets = countPackets(flux->bufLen, flux->mss);
+
+        setPacket(packet, flux->idFlux, ACK, packet->numSequence, packet->numSequence + 1, packet->ECN,
+                  packet->tailleFenetre, "", 0);
+        sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+        flux->status = ESTABLISHED;
+        wheelCancel(loop->wheel, &flux->timer); // the first packet arms it
+        initInflight(&flux->inflight, flux->numSeq + 1); // the first packet of the flux follows the SYN
+        DEBUG_PRINT("%d ---> ACK sent (mss = %d) | WAITING_SYN_ACK to ESTABLISHED\n", flux->idFlux, flux->mss);
+    }
+    else if (flux->status == ESTABLISHED && flux->packet_status == WAIT_ACK) // packet has been sent, waiting for his ACK
+    {
+        DEBUG_PRINT("Flux thread = %d, go packet, ack = %u, seqNum = %u, type = %s \n",
+                    flux->idFlux, packet->numAcquittement, packet->numSequence,
+                    packet->type & ACK ? "ACK" : "Other");
+
+        flux->received = 1;
+        if (packet->type & ACK && packet->type & SYN) // issue during the open connection process
+        {
+            packet->type = ACK;
+            packet->numAcquittement = packet->numSequence + 1;
+            packet->tailleDonnees = 0; // the MSS has already been negotiated
+            sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+            flux->packet_status = RESEND_PACKET; // not the type expected, we need to resend the packet
+            DEBUG_PRINT("%d ---> ISSUE : ack syn : RESEND_PACKET\n", flux->idFlux);
+        }
+        else if (packet->type & ACK && packet->numAcquittement == flux->numSeq) // corresponding ACK expected
+        {
+            // measures the RTT with the echo, else with the packet if it has been sent once (Karn)
+            struct segment *segment = inflightGet(&flux->inflight, flux->numSeq);
+            if (packet->echoHorodatage != 0)
+                rttAck(&flux->rtt, packet);
+            else if (segment != NULL && segment->retransmits == 0)
+                rttSample(&flux->rtt, timestampNow() - segment->sent);
+            inflightAck(&flux->inflight, flux->numSeq + 1);
+            wheelCancel(loop->wheel, &flux->timer); // the next packet arms it
+            flux->nb_done_packets++; // packet is done
+            flux->packet_status = SEND_PACKET; // next up, we want to send another packet
+
+            // if every packet has been sent, we are done here
+            if (flux->nb_done_packets >= flux->nb_packets)
             {
-                // read packet received from manager trough pipe
-                if (read(flux->pipe_read, packet, 52) != 52)
-                    raler("read pipe");
-                DEBUG_PRINT("%d ===== Read packet =====\n", flux->idFlux);
-
-                // we expect the type to be ACK|SYN in order to continue
-                if (!(packet->type & ACK) || !(packet->type & SYN)) // not ACK|SYN
-                {
-                    status = DISCONNECTED; // we need to restart the connection process
-                    DEBUG_PRINT("%d ---> not ACK|SYN : WAITING_SYN_ACK to DISCONNECTED\n", flux->idFlux);
-                }
-                else // ACK|SYN : process normally and send ACK
-                {
-                    packet->type = ACK;
-                    packet->numAcquittement = packet->numSequence + 1;
-                    sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
-                    status = ESTABLISHED;
-                    DEBUG_PRINT("%d ---> ACK sent | WAITING_SYN_ACK to ESTABLISHED\n", flux->idFlux);
-                }
+                flux->status = TERM_SEND_FIN;
+                DEBUG_PRINT("%d ---> start closing process : TERM_SEND_FIN\n", flux->idFlux);
             }
         }
+    }
+    else if (flux->status >= TERM_WAIT_ACK && flux->status <= TERM_WAIT_TERM) // continue close connection process
+        closeReceive(loop, flux, packet);
+}
 
-        if (status == DISCONNECTED) // about to start the connection
-        {
-            DEBUG_PRINT("%d ===== DISCONNECTED =====\n", flux->idFlux);
+/**
+ * @fn      void stopWaitTimeout(struct loop *loop, flux_state_t flux)
+ * @brief   Called when the timer of a flux expires (stop and wait mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux whose timer expired
+ */
+void stopWaitTimeout(struct loop *loop, flux_state_t flux)
+{
+    (void) loop;
 
-            numSeq = rand() % (UINT16_MAX / 2);
-            setPacket(packet, flux->idFlux, SYN, numSeq, 0, ECN_DISABLED, 0, "");
-            sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
-            status = WAITING_SYN_ACK; // now waiting for a packet with SYN|ACK
+    if (flux->status != TERM_WAIT_TERM) // something has been lost : the RTO is doubled until the next measure
+        rttBackoff(&flux->rtt);
 
-            DEBUG_PRINT("%d ---> DISCONNECTED to WAITING_SYN_ACK\n", flux->idFlux);
-        }
+    if (flux->status == WAITING_SYN_ACK)
+    {
+        flux->status = DISCONNECTED; // we need to restart the connection process
+        DEBUG_PRINT("%d ---> TIMEOUT : WAITING_SYN_ACK to DISCONNECTED\n", flux->idFlux);
+    }
+    else if (flux->status == ESTABLISHED && flux->packet_status == WAIT_ACK)
+    {
+        flux->packet_status = RESEND_PACKET; // we need to resend a packet
+        DEBUG_PRINT("%d ---> TIMEOUT : RESEND_PACKET\n", flux->idFlux);
+    }
+    else if (flux->status >= TERM_WAIT_ACK && flux->status <= TERM_WAIT_TERM)
+        closeTimeout(flux);
+}
 
-        if (status == ESTABLISHED) {
+/**
+ * @fn      void stopWaitStep(struct loop *loop, flux_state_t flux)
+ * @brief   Sends a packet, or whatever the flux has to send, and arms its timer (stop and wait mechanism)
+ * @param   loop        Loop of the flux
+ * @param   flux        Flux to drive
+ */
+void stopWaitStep(struct loop *loop, flux_state_t flux)
+{
+    packet_t packet = loop->packet;
 
-            DEBUG_PRINT("%d ===== ESTABLISHED =====\n", flux->idFlux);
+    // only ACKs we did not expect
+    if (flux->status == ESTABLISHED && flux->packet_status == WAIT_ACK && flux->received)
+    {
+        flux->packet_status = RESEND_PACKET; // we need to resend a packet
+        DEBUG_PRINT("%d ---> ISSUE : not ack expected : RESEND_PACKET\n", flux->idFlux);
+    }
+    flux->received = 0;
 
-            // if : packet has been sent, waiting for his ACK
-            if (packet_status == WAIT_ACK)
-            {
-                if (return_value == 0) // TIMEOUT
-                {
-                    packet_status = RESEND_PACKET; // we need to resend a packet
-                    DEBUG_PRINT("%d ---> TIMEOUT : RESEND_PACKET\n", flux->idFlux);
-                }
-                else if (return_value > 0) // no timeout : process normally
-                {
-                    // read packet received from manager trough pipe
-                    if (read(flux->pipe_read, packet, 52) != 52)
-                        raler("read pipe");
-
-                    DEBUG_PRINT("Flux thread = %d, go packet, ack = %d, seqNum = %d, type = %s \n",
-                                flux->idFlux, packet->numAcquittement, packet->numSequence,
-                                packet->type & ACK ? "ACK" : "Other");
-
-                    if (packet->type & ACK && packet->type & SYN) // issue during the open connection process
-                    {
-                        packet->type = ACK;
-                        packet->numAcquittement = packet->numSequence + 1;
-                        sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
-                        packet_status = RESEND_PACKET; // not the type expected, we need to resend the packet
-                        DEBUG_PRINT("%d ---> ISSUE : ack syn : RESEND_PACKET\n", flux->idFlux);
-                    }
-                    else
-                    {
-                        if (!(packet->type & ACK) || packet->numAcquittement != numSeq) // not corresponding ACK expected
-                        {
-                            packet_status = RESEND_PACKET; // we need to resend a packet
-                            DEBUG_PRINT("%d ---> ISSUE : not ack expected : RESEND_PACKET\n", flux->idFlux);
-                        }
-                        else
-                        {
-                            nb_done_packets++; // packet is done
-                            packet_status = SEND_PACKET; // next up, we want to send another packet
-
-                            // if every packet has been sent, we are done here
-                            if (nb_done_packets >= nb_packets)
-                            {
-                                status = TERM_SEND_FIN;
-                                DEBUG_PRINT("%d ---> start closing process : TERM_SEND_FIN\n", flux->idFlux);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    if (flux->status == DISCONNECTED) // about to start the connection
+    {
+        uint16_t mss_option = flux->tcp->mss; // MSS we announce in the SYN
+        DEBUG_PRINT("%d ===== DISCONNECTED =====\n", flux->idFlux);
 
-        if (status == ESTABLISHED) // sending a packet
-        {
-            // SEND_PACKET : update numSeq and data
-            // RESEND_PACKET : nothing to update
+        flux->numSeq = randomSeq(); // initial sequence number
+        setPacket(packet, flux->idFlux, SYN, flux->numSeq, 0, ECN_DISABLED, 0, (char *) &mss_option, sizeof(mss_option));
+        setTimestamp(packet, timestampNow(), 0);
+        sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+        flux->status = WAITING_SYN_ACK; // now waiting for a packet with SYN|ACK
 
-            if (packet_status == SEND_PACKET)
-            {
-                numSeq = numSeq == 0 ? 1 : 0; // alternative bit
+        DEBUG_PRINT("%d ---> DISCONNECTED to WAITING_SYN_ACK\n", flux->idFlux);
+    }
 
-                // get the corresponding data we need to send
-                int fromEnd = (nb_done_packets + 1) * PACKET_DATA_SIZE;
-                if (fromEnd > flux->bufLen)
-                    fromEnd = flux->bufLen - fromEnd;
-                substr(flux->buf, data, nb_done_packets * PACKET_DATA_SIZE, fromEnd);
-            }
+    if (flux->status == ESTABLISHED && flux->packet_status != WAIT_ACK) // sending a packet
+    {
+        // SEND_PACKET : update numSeq
+        // RESEND_PACKET : nothing to update, the tracker counts it as sent again
+        if (flux->packet_status == SEND_PACKET)
+            flux->numSeq++; // next packet
+        uint32_t now = timestampNow();
+        inflightSend(&flux->inflight, flux->numSeq, now);
+
+        // get the corresponding data we need to send, no copy : it is sent from the buffer
+        size_t offset = (size_t) flux->nb_done_packets * flux->mss; // position of the packet in the flux
+        const char *data = flux->buf + offset;
+        uint16_t data_len = MIN((size_t) flux->mss, flux->bufLen - offset);
+
+        DEBUG_PRINT("Send packet idFlux = %d, status = %s, data = %.*s\n", flux->idFlux,
+                    flux->packet_status == SEND_PACKET ? "Send packet" : "Resend packet", data_len, data);
+
+        // prepare the header and sending it along with the data
+        setHeader(packet, flux->idFlux, 0, flux->numSeq, 0, ECN_DISABLED, 0, data_len);
+        setTimestamp(packet, now, 0);
+        sendSegments(flux->tcp->outSocket, &packet, &data, NULL, 1, flux->tcp->sockaddr);
+        flux->packet_status = WAIT_ACK; // waiting for the ACK before sending another packet
+    }
 
-            DEBUG_PRINT("Send packet idFlux = %d, status = %s, data = %s\n", flux->idFlux, packet_status == SEND_PACKET ?
-                                                                                           "Send packet" : (packet_status == RESEND_PACKET ? "Resend packet": "Wait ACK"), data);
+    if (flux->status == TERM_SEND_FIN) // about to close the connection
+    {
+        DEBUG_PRINT("%d ===== TERM_SEND_FIN =====\n", flux->idFlux);
 
-            // prepare the packet and sending it
-            setPacket(packet, flux->idFlux, 0, numSeq, 0, ECN_DISABLED, 0, data);
-            sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
-            packet_status = WAIT_ACK; // waiting for the ACK before sending another packet
-        }
+        setPacket(packet, flux->idFlux, FIN, flux->numSeq + 1, 0, 0, 0, "", 0);
+        setTimestamp(packet, timestampNow(), 0);
+        sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
+        flux->status = TERM_WAIT_ACK; // now waiting for a packet with ACK
+
+        DEBUG_PRINT("%d ---> TERM_SEND_FIN to TERM_WAIT_ACK\n", flux->idFlux);
+    }
 
-        if (status >= TERM_WAIT_ACK && status <= TERM_WAIT_TERM) // continue close connection process
+    // 2x longer after the last ACK in the close connection process, the packets which don't move it on keep the deadline
+    uint64_t rto = rttTimeout(&flux->rtt);
+    if (!timerArmed(&flux->timer))
+        wheelArm(loop->wheel, &flux->timer, monotonicTime() + (flux->status == TERM_WAIT_TERM ? 2 * rto : rto));
+}
+
+const struct flux_ops goBackN = { goBackNReceive, goBackNTimeout, goBackNStep };
+const struct flux_ops stopWait = { stopWaitReceive, stopWaitTimeout, stopWaitStep };
+const struct flux_ops selectiveRepeat = { selectiveRepeatReceive, selectiveRepeatTimeout, selectiveRepeatStep };
+
+/**
+ * @fn      void *doLoop(void *arg)
+ * @brief   Drives its share of the fluxes : treats the packets the manager sends them trough the ring, their timeouts,
+ *          and lets them send packets back (mechanism chosen by the user)
+ * @param   arg         Argument send when the thread was created, struct loop in this case
+ */
+void *doLoop(void *arg)
+{
+    struct loop *loop = (struct loop *) arg; // structure
+
+    // packet popped from the ring, it never carries data
+    packet_t packet;
+    if (poolPackets(loop->pool, &packet, 1) != 1)
+        raler("poolPackets");
+
+    // fluxes that received something or timed out, they act once everything has been treated
+    flux_state_t *pending = malloc(sizeof(flux_state_t) * loop->nb_flux);
+    int nb_pending;
+    if (pending == NULL)
+        raler("malloc");
+
+    struct epoll_event events[2]; // ring and timers
+
+    // every flux starts by opening its connection
+    for (int i = 0; i < loop->nb_flux; ++i)
+        loop->ops->step(loop, loop->fluxes[i]);
+
+    while (loop->nb_active > 0)
+    {
+        nb_pending = 0;
+
+        // treat every packet the manager queued for our fluxes
+        while (ringPop(loop->ring, packet) == 0)
         {
-            DEBUG_PRINT("%d ===== TERM_WAIT_ACK - TERM_WAIT_TERM =====\n", flux->idFlux);
+            flux_state_t flux = loop->all[packet->idFlux];
+            if (flux->over)
+                continue;
+
+            loop->ops->receive(loop, flux, packet);
+            if (!flux->pending)
+            {
+                flux->pending = 1;
+                pending[nb_pending++] = flux;
+            }
+        }
 
-            if (return_value == 0) // TIMEOUT
+        // fluxes whose timer expired, even the ones which received something : only progress stopped their timer
+        struct timer *timer = wheelExpire(loop->wheel, monotonicTime());
+        while (timer != NULL)
+        {
+            struct timer *expired = timer;
+            flux_state_t flux = (flux_state_t) timer->data;
+            timer = timer->next;
+            if (flux->over)
+                continue;
+
+            if (expired != &flux->pace) // the pacer only lets the flux send again
+                loop->ops->timeout(loop, flux);
+            if (flux->over)
             {
-                if (status == TERM_WAIT_ACK || status == TERM_WAIT_FIN) // we need to restart the close connection process
-                {
-                    status = TERM_SEND_FIN;
-                    DEBUG_PRINT("%d ---> TIMEOUT : to TERM_SEND_FIN\n", flux->idFlux);
-                }
-                else if (status == TERM_WAIT_TERM) // closing process has succeeded
-                {
-                    DEBUG_PRINT("%d ---> TIMEOUT : TERM_WAIT_TERM, thread stopping...\n", flux->idFlux);
-                    break;
-                }
+                loop->nb_active--;
+                continue;
             }
-            else if (return_value > 0)
+            if (!flux->pending)
             {
-                // read packet received from manager trough pipe
-                if (read(flux->pipe_read, packet, 52) != 52)
-                    raler("read pipe");
-                DEBUG_PRINT("%d ===== Read packet =====\n", flux->idFlux);
-
-                // waiting for FIN in order to send the last ACK
-                if (status == TERM_WAIT_FIN && packet->type & FIN)
-                {
-                    setPacket(packet, flux->idFlux, ACK, packet->numSequence, packet->numSequence + 1, 0, 0, "");
-                    sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
-                    status = TERM_WAIT_TERM; // last step before the end
-                    DEBUG_PRINT("%d ---> Wait FIN : TERM_WAIT_FIN to TERM_WAIT_TERM\n", flux->idFlux);
-                }
-
-                // we sent FIN and are waiting for its ACK
-                if (status == TERM_WAIT_ACK && packet->type & ACK) {
-                    status = TERM_WAIT_FIN; // continue the close connection process
-                    DEBUG_PRINT("%d ---> Wait ACK (FIN) : TERM_WAIT_ACK to TERM_WAIT_FIN\n", flux->idFlux);
-                }
+                flux->pending = 1;
+                pending[nb_pending++] = flux;
             }
         }
 
-        if (status == TERM_SEND_FIN) // about to close the connection
+        // every flux acts once, whatever the number of packets it received
+        for (int i = 0; i < nb_pending; ++i)
         {
-            DEBUG_PRINT("%d ===== TERM_SEND_FIN =====\n", flux->idFlux);
-
-            numSeq = rand() % (UINT16_MAX / 2);
-            setPacket(packet, flux->idFlux, FIN, numSeq, 0, 0, 0, "");
-            sendPacket(flux->tcp->outSocket, packet, flux->tcp->sockaddr);
-            status = TERM_WAIT_ACK; // now waiting for a packet with ACK
-
-            DEBUG_PRINT("%d ---> TERM_SEND_FIN to TERM_WAIT_ACK\n", flux->idFlux);
+            pending[i]->pending = 0;
+            if (!pending[i]->over)
+                loop->ops->step(loop, pending[i]);
         }
 
-        FD_ZERO(&working_set);
-        FD_SET(flux->pipe_read, &working_set);
-
-        tv.tv_sec = 0;
-        tv.tv_usec = status == TERM_WAIT_TERM ? 8 * TIMEOUT : 4 * TIMEOUT; // 2x longer after the last ACK in the close connection process
-        DEBUG_PRINT("%d ===== SELECT ===== %d and wait sec = %ld, usec = %ld\n", flux->idFlux, flux->pipe_read, tv.tv_sec, tv.tv_usec);
+        if (loop->nb_active == 0 || ringPark(loop->ring)) // done, or the manager already sent us something
+            continue;
 
-        // waiting for a packet to be send from the manager (trough pipe)
-        return_value = select(flux->pipe_read + 1, &working_set, NULL, NULL, &tv);
-        if (return_value == -1) raler("select ici\n");
-        DEBUG_PRINT("%d ===== Received packet =====\n", flux->idFlux);
+        // waiting for the manager to wake us up, or for the next timer to expire
+        wheelSchedule(loop->wheel);
+        int nb_events = epoll_wait(loop->epoll, events, 2, -1);
+        if (nb_events == -1 && errno != EINTR)
+            raler("epoll_wait");
+        ringUnpark(loop->ring);
 
-    } while (1);
+        for (int i = 0; i < nb_events; ++i)
+        {
+            uint64_t expirations;
+            if (events[i].data.ptr == loop->wheel
+                && read(loop->wheel->timerfd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+                raler("read timerfd");
+        }
+    }
 
+    free(pending);
+    socketThreadExit();
     return NULL;
 }
 
 /**
  * @fn      void *doManager(void *arg)
- * @brief   Receives the packets from the medium and sends them to the corresponding flux (threads) through pipes
+ * @brief   Receives the packets from the medium and sends them to the loop of the corresponding flux through rings
  * @param   arg         Argument send when the thread was created, struct manager in this case
  */
 void *doManager(void *arg)
 {
     struct manager main_thr = *(struct manager *) arg; // structure
-    packet_t packet = newPacket(); // init a packet used to store and send data
-    ssize_t return_value; // used to check for timeouts
 
-    // timeout parameters
-    struct timeval timeval;
-    timeval.tv_usec = TIMEOUT;
-    timeval.tv_sec = 0;
+    // packets received at once (backlog of ACKs), they never carry data
+    packet_t packets[PACKET_BATCH_SIZE];
+    pool_t received = newPool(PACKET_BATCH_SIZE, PACKET_OPTIONS_SIZE);
+    if (poolPackets(received, packets, PACKET_BATCH_SIZE) != PACKET_BATCH_SIZE)
+        raler("poolPackets");
 
-    // On considère que les timeout sont important ici,
-    // Car on souhaite checker si le pointeur thread_status change
-    // Et si recvfrom est bloquant on pourra pas sortir du thread
-    if (setsockopt(main_thr.tcp->inSocket, SOL_SOCKET, SO_RCVTIMEO, &timeval, sizeof(timeval)) < 0)
-        raler("setsockopt");
+    // sleeps until a packet arrives or until we have to stop, no need to wake up regularly
+    struct pollfd fds[2];
+    fds[0].fd = recvFd(main_thr.tcp->inSocket, PACKET_CONTROL_SIZE); // the socket, or the io_uring receiving from it
+    fds[0].events = POLLIN;
+    fds[1].fd = main_thr.stop;
+    fds[1].events = POLLIN;
 
-    do // until thread_status value is "STOP"
+    while (1) // until stop is readable
     {
-        /* receive packet */
-        return_value = recvfrom(main_thr.tcp->inSocket, packet, 52, 0, NULL, NULL);
-        //DEBUG_PRINT("doManager: recvfrom socket = %d\n", main_thr.tcp->inSocket);
-
-        if (return_value < 0) // timeout
+        // packets cut from a coalesced datagram are still waiting : no need to sleep
+        fds[1].revents = 0;
+        if (!recvPending() && poll(fds, 2, -1) == -1)
         {
-            //DEBUG_PRINT("doManager: timeout...\n");
-            continue; // ignored because it's handled separately
+            if (errno == EINTR)
+                continue;
+            raler("poll");
         }
+        if (fds[1].revents & POLLIN)
+            break;
 
-        //DEBUG_PRINT("recv for flux = %d\n", packet->idFlux);
-
-        if (packet->idFlux >= main_thr.nb_flux) // check : idFlux exists
-            continue;
+        /* receive every packet already waiting, at least one */
+        int nb_received = recvPackets(packets, main_thr.tcp->inSocket, PACKET_BATCH_SIZE, PACKET_CONTROL_SIZE);
+        //DEBUG_PRINT("doManager: recvmmsg socket = %d\n", main_thr.tcp->inSocket);
 
-        //DEBUG_PRINT("doManager: write to flux: %d, pipe_write = %d\n", packet->idFlux,
-                    //main_thr.pipes[packet->idFlux]);
+        if (nb_received < 0)
+            raler("recvmmsg");
 
-        // send packet to flux using pipes (flux corresponding to packet->idFlux)
-        return_value = write(main_thr.pipes[packet->idFlux], packet, 52);
-        if (return_value < 0)
+        for (int i = 0; i < nb_received; ++i)
         {
-            printf("Write failed for flux=%d, pipe fd=%d\n", packet->idFlux, main_thr.pipes[packet->idFlux]);
-            raler("manager: write");
-        }
+            packet_t packet = packets[i];
+            //DEBUG_PRINT("recv for flux = %d\n", packet->idFlux);
+
+            if (packet->idFlux >= main_thr.nb_flux) // check : idFlux exists
+                continue;
 
-    } while (*main_thr.thr_status != STOP);
+            // send packet to the loop of the flux using its ring (flux corresponding to packet->idFlux)
+            // the loop is too late when its ring is full : the packet is dropped, like the network would
+            if (ringPush(main_thr.rings[packet->idFlux % main_thr.nb_loops], packet, packetSize(packet)) == -1)
+                DEBUG_PRINT("doManager: ring full for flux=%d, packet dropped\n", packet->idFlux);
+        }
+    }
 
     /* End of the manager thread */
 
     //DEBUG_PRINT("doManager: main thread stopping...\n");
 
-    destroyPacket(packet);
+    destroyPool(received);
+    socketThreadExit();
     pthread_exit(NULL);
 }
 
 /**
- * @fn      handle(tcp_t tcp, modeTCP_t mode, struct flux *fluxes, int nb_flux)
+ * @fn      handle(tcp_t tcp, modeTCP_t mode, const struct congestion_ops *cc, pacing_mode_t pacing, struct flux *fluxes, int nb_flux, int nb_loops)
  * @brief   Executes the "source" mechanism
  * @param   tcp         TCP structure
  * @param   mode        Mechanism chosen by the user
+ * @param   cc          Congestion control chosen by the user
+ * @param   pacing      Pacing chosen by the user
  * @param   *fluxes     All of the fluxes
  * @param   nb_flux     Total number of fluxes we will be using
+ * @param   nb_loops    Number of event loops (threads) driving the fluxes
  */
-void handle(tcp_t tcp, modeTCP_t mode, struct flux *fluxes, int nb_flux)
+void handle(tcp_t tcp, modeTCP_t mode, const struct congestion_ops *cc, pacing_mode_t pacing, struct flux *fluxes, int nb_flux, int nb_loops)
 {
-    thread_status_t *thr_status = malloc(sizeof(thread_status_t));
-    pthread_t *thr_id = malloc(sizeof(pthread_t) * (nb_flux + 1)); // list of all the threads id : manager + one for each flux
-    struct flux_args fluxes_thr[FLUX_NB]; // list of all the threads related to fluxes : one for each flux
+    pthread_t *thr_id = malloc(sizeof(pthread_t) * (nb_loops + 1)); // list of all the threads id : manager + one for each loop
+    flux_state_t *all = malloc(sizeof(flux_state_t) * nb_flux); // every flux, indexed by idFlux
+    struct loop **loops = malloc(sizeof(struct loop *) * nb_loops); // list of all the loops, each one drives a share of the fluxes
+
+    // list of all the rings : one for each loop, the manager pushes packets and the loop pops them
+    ring_t *rings = malloc(sizeof(ring_t) * nb_loops);
 
-    // list of all the pipes : one for each flux, fluxes can communicate with the manager
-    int **pipes = malloc(sizeof(int) * nb_flux);
-    int write_pipes[FLUX_NB]; // used for the manager (writing pipes)
+    if (thr_id == NULL || all == NULL || loops == NULL || rings == NULL)
+        raler("malloc");
 
-    // creates the manager of all the fluxes
+    // creates the loops
+    for (int i = 0; i < nb_loops; ++i)
+    {
+        struct loop *loop = malloc(sizeof(struct loop));
+        if (loop == NULL)
+            raler("malloc");
+
+        loop->id = i;
+        loop->tcp = tcp;
+        // different functions, depending on the mode the user chose
+        if (mode == STOP_AND_WAIT)
+            loop->ops = &stopWait;
+        else if (mode == SELECTIVE_REPEAT)
+            loop->ops = &selectiveRepeat;
+        else
+            loop->ops = &goBackN;
+        loop->all = all;
+        loop->nb_flux = 0;
+        loop->fluxes = malloc(sizeof(flux_state_t) * (nb_flux / nb_loops + 1));
+        if (loop->fluxes == NULL)
+            raler("malloc");
+
+        // the packet, the headers of the burst and the packet popped from the ring, they never carry data
+        loop->pool = newPool(LOOP_BURST_SIZE + 2, PACKET_OPTIONS_SIZE);
+        if (poolPackets(loop->pool, &loop->packet, 1) != 1 || poolPackets(loop->pool, loop->burst, LOOP_BURST_SIZE) != LOOP_BURST_SIZE)
+            raler("poolPackets");
+
+        // the loop sleeps until the manager pushes a packet in its ring, or until one of its timers expires
+        rings[i] = newRing(RING_SIZE, PACKET_CONTROL_SIZE);
+        loop->ring = rings[i];
+        loop->wheel = newWheel();
+        loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll == -1)
+            raler("epoll_create1");
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = loop->ring;
+        if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->ring->eventfd, &event) == -1)
+            raler("epoll_ctl");
+        event.data.ptr = loop->wheel;
+        if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->wheel->timerfd, &event) == -1)
+            raler("epoll_ctl");
+
+        loops[i] = loop;
+    }
+
+    // creates the state of each flux, driven by the loop idFlux % nb_loops
+    for (int i = 0; i < nb_flux; i++)
+    {
+        struct flux flux = fluxes[i];
+        flux_state_t state = calloc(1, sizeof(struct flux_state));
+        if (state == NULL)
+            raler("calloc");
+
+        state->tcp = tcp;
+        state->idFlux = flux.fluxId;
+        state->buf = malloc(flux.bufLen);
+        state->bufLen = flux.bufLen;
+        memcpy(state->buf, flux.buf, flux.bufLen);
+        state->status = DISCONNECTED; // flux status by default
+        state->packet_status = SEND_PACKET; // packet status by default
+        state->mss = tcp->mss;
+        state->nb_packets = countPackets(flux.bufLen, tcp->mss);
+        initTimer(&state->timer, state);
+        initTimer(&state->pace, state);
+        initRtt(&state->rtt);
+        initCongestion(&state->cc, cc);
+        initPacer(&state->pacer, mode == STOP_AND_WAIT ? PACING_NONE : pacing); // a single segment in flight
+        //DEBUG_PRINT("create flux_state for flux=%d; idFlux=%d\n", i, flux.fluxId);
+
+        all[flux.fluxId] = state;
+        struct loop *loop = loops[flux.fluxId % nb_loops];
+        loop->fluxes[loop->nb_flux++] = state;
+    }
+
+    // creates main thread (manager)
     struct manager main_thr;
     main_thr.tcp = tcp; // TCP structure used to communicate
     main_thr.nb_flux = nb_flux; // number of fluxes the main thread will manage
-    main_thr.pipes = write_pipes; // writing part of pipes used to communicate with each flux
-    main_thr.thr_status = thr_status; // thread status (not working)
-
-    // creates main thread (manager)
+    main_thr.nb_loops = nb_loops; // number of loops driving them
+    main_thr.rings = rings; // rings used to communicate with each loop
+    main_thr.stop = eventfd(0, EFD_CLOEXEC); // written once every loop is over
+    if (main_thr.stop == -1)
+        raler("eventfd");
     //DEBUG_PRINT("Start manager thread\n");
     pthread_create(&thr_id[0], NULL, (void *) doManager, (void *) &main_thr);
 
-    // creates a thread for each flux
-    for (int i = 0; i < nb_flux; i++)
+    // creates nb_loops threads, each one driving its share of the fluxes
+    for (int i = 1; i <= nb_loops; ++i)
     {
-        // creates a flux structure
-        struct flux flux = fluxes[i];
-        fluxes_thr[i].tcp = tcp;
-        fluxes_thr[i].idFlux = flux.fluxId;
-        fluxes_thr[i].buf = malloc(flux.bufLen);
-        fluxes_thr[i].bufLen = flux.bufLen;
-        strcpy(fluxes_thr[i].buf, flux.buf);
-        //DEBUG_PRINT("create flux_thr for flux=%d; idFlux=%d\n", i, flux.fluxId);
-
-        // open pipe for the thread (flux) to communicate with the manager
-        pipes[i] = malloc(sizeof(int) * 2);
-        if (pipe(pipes[i]) < 0) perror("pipe");
-
-        // set pipes for manager thread (write) and flux thread (read)
-        fluxes_thr[i].pipe_read = pipes[i][0];
-        write_pipes[i] = pipes[i][1];
-        //DEBUG_PRINT("Opened new pipe for flux=%d; read=%d, write=%d\n", i, pipes[i][0], pipes[i][1]);
-    }
-
-    // creates nb_flux threads, each one corresponding to a flux
-    // different function, depending on the mode the user chose
-    for (int i = 1; i <= nb_flux; ++i)
-        if (pthread_create(&thr_id[i], NULL, mode == STOP_AND_WAIT ? (void *) doStopWait : (void *) doGoBackN,(void *) &fluxes_thr[i - 1]) > 0)
+        loops[i - 1]->nb_active = loops[i - 1]->nb_flux;
+        if (pthread_create(&thr_id[i], NULL, doLoop, (void *) loops[i - 1]) > 0)
             perror("pthread");
+    }
 
-    // waiting for each thread (flux) to end
-    for (int i = 1; i <= nb_flux; ++i)
+    // waiting for each loop to end
+    for (int i = 1; i <= nb_loops; ++i)
         if (pthread_join(thr_id[i], NULL) > 0)
             perror("pthread_join");
 
-    //DEBUG_PRINT("All flux threads stopped...\n");
+    //DEBUG_PRINT("All loops stopped...\n");
 
-    // stoping the manager (not working)
-    *thr_status = STOP;
+    // stoping the manager
+    uint64_t one = 1;
+    if (write(main_thr.stop, &one, sizeof(one)) != sizeof(one))
+        raler("write eventfd");
 
     // waiting for the manager to end
     if (pthread_join(thr_id[0], NULL) > 0)
@@ -801,15 +1661,28 @@ void handle(tcp_t tcp, modeTCP_t mode, struct flux *fluxes, int nb_flux)
 
     // END : close and free everything
 
+    close(main_thr.stop);
+    for (int i = 0; i < nb_loops; ++i)
+    {
+        close(loops[i]->epoll);
+        destroyWheel(loops[i]->wheel);
+        destroyRing(loops[i]->ring);
+        destroyPool(loops[i]->pool);
+        free(loops[i]->fluxes);
+        free(loops[i]);
+    }
+
     for (int i = 0; i < nb_flux; ++i)
     {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
-        free(pipes[i]);
+        free(all[fluxes[i].fluxId]->buf);
+        destroyInflight(&all[fluxes[i].fluxId]->inflight);
+        free(all[fluxes[i].fluxId]);
     }
 
+    free(rings);
+    free(loops);
+    free(all);
     free(thr_id);
-    free(thr_status);
 }
 
 /**
@@ -818,52 +1691,100 @@ void handle(tcp_t tcp, modeTCP_t mode, struct flux *fluxes, int nb_flux)
  */
 int main(int argc, char *argv[])
 {
+    int nbflux = FLUX_NB;
+    int nbloops = (int) sysconf(_SC_NPROCESSORS_ONLN); // one loop for each core by default
+    const struct congestion_ops *cc = &newReno; // congestion control by default
+    pacing_mode_t pacing = PACING_NONE; // the whole window at once by default
+    int opt;
+
+    // options : number of fluxes, of loops, congestion control, pacing, io_uring and a single connected socket
+    while ((opt = getopt(argc, argv, "f:l:c:p:us")) != -1)
+    {
+        if (opt == 'f')
+            nbflux = string_to_int(optarg);
+        else if (opt == 'l')
+            nbloops = string_to_int(optarg);
+        else if (opt == 'c' && (cc = findCongestion(optarg)) == NULL)
+        {
+            fprintf(stderr, "Usage: <congestion> must be either 'newreno', 'cubic' or 'bbr'\n");
+            exit(1);
+        }
+        else if (opt == 'p' && (pacing = parsePacing(optarg)) == PACING_NONE)
+        {
+            fprintf(stderr, "Usage: <pacing> must be either 'bucket' or 'txtime'\n");
+            exit(1);
+        }
+        else if (opt == 'u')
+            uringBackend = 1;
+        else if (opt == 's')
+            udpConnected = 1;
+        else if (opt != 'c' && opt != 'p')
+            argc = 0; // unknown option : usage
+    }
+
     // if : args unvalid
 
-    if (argc < 4)
+    if (argc - optind < 4)
     {
-        fprintf(stderr, "Usage: %s <mode> <IP_distante> <port_local> <port_ecoute_src_pertubateur>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-f nb_flux] [-l nb_loops] [-c congestion] [-p pacing] [-u] [-s] <mode> <IP_distante> <port_local> <port_ecoute_src_pertubateur>\n", argv[0]);
         exit(1);
     }
 
-    modeTCP_t mode = parseMode(argv[1]);
+    modeTCP_t mode = parseMode(argv[optind]);
 
     if (mode == UNKNOWN)
     {
-        fprintf(stderr, "Usage: <mode> must be either 'stop-wait' or 'go-back-n'\n");
+        fprintf(stderr, "Usage: <mode> must be either 'stop-wait', 'go-back-n' or 'selective-repeat'\n");
+        exit(1);
+    }
+
+    if (nbflux < 1 || nbflux > PACKET_MAX_FLUX)
+    {
+        fprintf(stderr, "Usage: nb_flux must be between 1 and %d\n", PACKET_MAX_FLUX);
         exit(1);
     }
 
+    // no more loops than fluxes, at least one
+    nbloops = MAX(1, MIN(nbloops, nbflux));
+
     // else
 
-    char *ip = argv[2];
-    int port_local = string_to_int(argv[3]);
-    int port_medium = string_to_int(argv[4]);
+    char *ip = argv[optind + 1];
+    int port_local = string_to_int(argv[optind + 2]);
+    int port_medium = string_to_int(argv[optind + 3]);
 
-    DEBUG_PRINT("\nMode chosen : %d\nDestination address : %s\nLocal port set at : %d\nDestination port set at : %d\n=================================\n", mode, ip, port_local, port_medium);
+    DEBUG_PRINT("\nMode chosen : %d\nDestination address : %s\nLocal port set at : %d\nDestination port set at : %d\nFluxes : %d on %d loops\nCongestion control : %s\n=================================\n", mode, ip, port_local, port_medium, nbflux, nbloops, cc->name);
 
+    udpTxtime = pacing == PACING_TXTIME;
     tcp_t tcp = createTcp(ip, port_local, port_medium);
+    if (pacing == PACING_TXTIME && !udpTxtime) // the kernel can't : the loops hold the packets themselves
+        pacing = PACING_BUCKET;
 
-    int nbflux = FLUX_NB;
-    struct flux fluxes[FLUX_NB];
+    struct flux *fluxes = malloc(sizeof(struct flux) * nbflux);
+    if (fluxes == NULL)
+        raler("malloc");
 
     for (int i = 0; i < nbflux; ++i)
     {
 
-        int spam = 10 * 44;
+        size_t spam = 10 * 44;
         //rand() % (UINT8_MAX) + UINT8_MAX * 30; + UINT8_MAX*500 ; * 10; + UINT8_MAX * 1000;
         fluxes[i].buf = malloc(spam);
 
-        for (int j = 0; j < spam; ++j)
+        for (size_t j = 0; j < spam; ++j)
             fluxes[i].buf[j] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"[random() % 26];
 
         fluxes[i].bufLen = spam;
         fluxes[i].fluxId = i;
     }
 
-    handle(tcp, mode, fluxes, nbflux);
+    handle(tcp, mode, cc, pacing, fluxes, nbflux, nbloops);
+
+    for (int i = 0; i < nbflux; ++i)
+        free(fluxes[i].buf);
+    free(fluxes);
 
     destroyTcp(tcp);
 
     return 0;
-}
\ No newline at end of file
+}